@@ -0,0 +1,437 @@
+/*
+author: suninf
+description: algorithms over whole tst_maps.
+			 tst_walker: sorted traversal with an explicit stack.
+			 diff( a, b, v ): walks two maps in lockstep and reports the keys
+			 that differ. On two versions of a tst_mvcc_map it skips the
+			 subtrees they share, so it costs the paths changed between them.
+			 set_union, set_intersection, set_difference: descend both trees
+			 level by level at once and build the result directly, every
+			 level a balanced BST; with C++11 the top level can be split over
+			 threads.
+*/
+
+#ifndef TST_ALGORITHM_H
+#define TST_ALGORITHM_H
+
+#include <algorithm>
+#include <vector>
+#include "tst_map.h"
+
+#if __cplusplus >= 201103L || ( defined(_MSVC_LANG) && _MSVC_LANG >= 201103L )
+#include <thread>
+#define TST_HAS_THREADS 1
+#endif
+
+namespace tst {
+
+// visits the entries of a tst_map in key order (by Comp), one at a time;
+// also a tst_mvcc_map::version
+template<typename Map>
+class tst_walker
+{
+public:
+	typedef typename Map::node_ptr node_ptr;
+	typedef typename Map::tstring tstring;
+	typedef typename Map::value_type value_type;
+
+public:
+	explicit tst_walker( const Map& m ) : value_(0)
+	{
+		__push( m.root() );
+	}
+
+	bool next() // false at the end
+	{
+		value_ = 0;
+		while ( !stack_.empty() )
+		{
+			__frame& f = stack_.back();
+			node_ptr p = f.p;
+			switch ( f.state++ )
+			{
+			case 0: // lower characters first
+				__push( p->lokid );
+				break;
+			case 1: // then the key ending here
+				key_.push_back( p->splitchar );
+				if ( p->pdata )
+				{
+					value_ = &*p->pdata;
+					return true;
+				}
+				break;
+			case 2: // then the longer keys
+				__push( p->eqkid );
+				break;
+			default: // then the higher characters, in place of this frame
+				key_.erase( key_.begin() + key_.size() - 1 );
+				stack_.pop_back();
+				__push( p->hikid );
+				break;
+			}
+		}
+		return false;
+	}
+
+	const tstring& key() const { return key_; }
+
+	const value_type* value() const { return value_; }
+
+	// the subtree the walk is about to enter, 0 if it is inside a node;
+	// moves over the steps that yield nothing first
+	node_ptr upcoming()
+	{
+		while ( !stack_.empty() )
+		{
+			__frame& f = stack_.back();
+			if ( f.state == 0 )
+				return f.p;
+			if ( f.state == 1 && f.p->pdata )
+				return 0;
+			if ( f.state == 1 )
+			{
+				key_.push_back( f.p->splitchar );
+				f.state = 2;
+			}
+			else if ( f.state == 2 )
+			{
+				f.state = 3;
+				__push( f.p->eqkid );
+			}
+			else
+			{
+				node_ptr hi = f.p->hikid;
+				key_.erase( key_.begin() + key_.size() - 1 );
+				stack_.pop_back();
+				__push( hi );
+			}
+		}
+		return 0;
+	}
+
+	void skip() // leave out the upcoming subtree
+	{
+		stack_.pop_back();
+	}
+
+private: // inner use for implement
+	struct __frame
+	{
+		node_ptr p;
+		int state;
+	};
+
+	void __push( node_ptr p )
+	{
+		if ( p )
+		{
+			__frame f = { p, 0 };
+			stack_.push_back( f );
+		}
+	}
+
+private:
+	std::vector<__frame> stack_;
+	tstring key_;
+	const value_type* value_;
+};
+
+template<typename Map>
+struct __key_less
+{
+	bool operator()( const typename Map::tstring& a, const typename Map::tstring& b ) const
+	{
+		typename Map::key_compare comp;
+		return std::lexicographical_compare( a.begin(), a.end(), b.begin(), b.end(), comp );
+	}
+};
+
+template<typename Map>
+void __skip_shared( tst_walker<Map>& wa, tst_walker<Map>& wb )
+{
+	typename Map::node_ptr p;
+	while ( (p = wa.upcoming()) != 0 && p == wb.upcoming() && wa.key() == wb.key() )
+	{
+		wa.skip();
+		wb.skip();
+	}
+}
+
+// calls v( key, const T* in_a, const T* in_b ) in key order for every key
+// only in a (in_b is 0), only in b (in_a is 0), or in both with values
+// that are not ==. Subtrees both maps point to are not entered, which
+// happens between versions of a tst_mvcc_map; two tst_maps share none.
+template<typename Map, typename Visitor>
+void diff( const Map& a, const Map& b, Visitor v )
+{
+	typedef typename Map::value_type T;
+	tst_walker<Map> wa( a ), wb( b );
+	__key_less<Map> less;
+
+	__skip_shared( wa, wb );
+	bool ha = wa.next(), hb = wb.next();
+	while ( ha || hb )
+	{
+		if ( !hb || ( ha && less( wa.key(), wb.key() ) ) )
+		{
+			v( wa.key(), wa.value(), (const T*)0 );
+			ha = wa.next();
+		}
+		else if ( !ha || less( wb.key(), wa.key() ) )
+		{
+			v( wb.key(), (const T*)0, wb.value() );
+			hb = wb.next();
+		}
+		else
+		{
+			if ( !( *wa.value() == *wb.value() ) )
+				v( wa.key(), wa.value(), wb.value() );
+			__skip_shared( wa, wb );
+			ha = wa.next();
+			hb = wb.next();
+		}
+	}
+}
+
+enum set_op { set_op_union, set_op_intersection, set_op_difference };
+
+// simultaneous descent of two trees for the set operations
+template<typename Map, typename Policy>
+class __set_combiner
+{
+public:
+	typedef typename Map::node_type node_type;
+	typedef typename Map::node_ptr node_ptr;
+	typedef typename Map::value_type T;
+
+	__set_combiner( set_op op, Policy policy ) : op_(op), policy_(policy) {}
+
+	// the combined level of a and b, values counted in n
+	node_ptr level( node_ptr a, node_ptr b, size_t& n )
+	{
+		std::vector<node_ptr> la, lb, out;
+		__pairs( a, b, la, lb );
+		for ( size_t i = 0; i < la.size(); ++i )
+		{
+			node_ptr p = node( la[i], lb[i], n );
+			if ( p )
+				out.push_back( p );
+		}
+		return balance( out, 0, out.size() );
+	}
+
+	// the characters of both levels in order, paired up; 0 where one lacks it
+	static void __pairs( node_ptr a, node_ptr b, std::vector<node_ptr>& pa, std::vector<node_ptr>& pb )
+	{
+		std::vector<node_ptr> la, lb;
+		__inorder( a, la );
+		__inorder( b, lb );
+		typename Map::key_compare comp;
+		size_t i = 0, j = 0;
+		while ( i < la.size() || j < lb.size() )
+		{
+			if ( j == lb.size() || ( i < la.size() && comp( la[i]->splitchar, lb[j]->splitchar ) ) )
+			{
+				pa.push_back( la[i++] );
+				pb.push_back( 0 );
+			}
+			else if ( i == la.size() || comp( lb[j]->splitchar, la[i]->splitchar ) )
+			{
+				pa.push_back( 0 );
+				pb.push_back( lb[j++] );
+			}
+			else
+			{
+				pa.push_back( la[i++] );
+				pb.push_back( lb[j++] );
+			}
+		}
+	}
+
+	// the result node for one character, 0 if nothing is left of it
+	node_ptr node( node_ptr a, node_ptr b, size_t& n )
+	{
+		if ( !b )
+			return op_ == set_op_intersection ? 0 : __clone_node( a, n );
+		if ( !a )
+			return op_ == set_op_union ? __clone_node( b, n ) : 0;
+
+		T* val = 0;
+		if ( op_ == set_op_union )
+		{
+			if ( a->pdata && b->pdata )
+			{
+				val = new T( *(a->pdata) );
+				policy_( *val, *(const T*)b->pdata );
+			}
+			else if ( a->pdata || b->pdata )
+				val = new T( a->pdata ? *(a->pdata) : *(b->pdata) );
+		}
+		else if ( op_ == set_op_intersection )
+		{
+			if ( a->pdata && b->pdata )
+			{
+				val = new T( *(a->pdata) );
+				policy_( *val, *(const T*)b->pdata );
+			}
+		}
+		else if ( a->pdata && !b->pdata )
+			val = new T( *(a->pdata) );
+
+		node_ptr eq = level( a->eqkid, b->eqkid, n );
+		if ( !val && !eq )
+			return 0;
+		node_ptr p = new node_type( a->splitchar );
+		p->pdata = val;
+		p->eqkid = eq;
+		if ( val )
+			++n;
+		return p;
+	}
+
+	static node_ptr balance( std::vector<node_ptr>& v, size_t lo, size_t hi )
+	{
+		if ( lo >= hi )
+			return 0;
+		size_t mid = lo + (hi - lo) / 2;
+		node_ptr p = v[mid];
+		p->lokid = balance( v, lo, mid );
+		p->hikid = balance( v, mid+1, hi );
+		return p;
+	}
+
+private: // inner use for implement
+	static void __inorder( node_ptr p, std::vector<node_ptr>& v )
+	{
+		if ( !p )
+			return;
+		__inorder( p->lokid, v );
+		v.push_back( p );
+		__inorder( p->hikid, v );
+	}
+
+	static node_ptr __clone_node( node_ptr p, size_t& n ) // p with its eqkid subtree
+	{
+		node_ptr q = new node_type( p->splitchar );
+		if ( p->pdata )
+		{
+			q->pdata = new T( *(p->pdata) );
+			++n;
+		}
+		q->eqkid = __clone_tree( p->eqkid, n );
+		return q;
+	}
+
+	static node_ptr __clone_tree( node_ptr p, size_t& n )
+	{
+		if ( !p )
+			return 0;
+		node_ptr q = __clone_node( p, n );
+		q->lokid = __clone_tree( p->lokid, n );
+		q->hikid = __clone_tree( p->hikid, n );
+		return q;
+	}
+
+private:
+	set_op op_;
+	Policy policy_;
+};
+
+// out = op( a, b ); out may be a or b. Where a key is in both, the value
+// is a's, passed through policy( value, b's value ) for union/intersection
+template<typename Map, typename Policy>
+void set_combine( const Map& a, const Map& b, Map& out, set_op op, Policy policy )
+{
+	__set_combiner<Map, Policy> c( op, policy );
+	size_t n = 0;
+	typename Map::node_ptr root = c.level( a.root(), b.root(), n );
+	tst_access::adopt( out, root, n );
+}
+
+template<typename Map>
+void set_union( const Map& a, const Map& b, Map& out ) // b's values win
+{
+	set_combine( a, b, out, set_op_union, merge_replace() );
+}
+
+template<typename Map>
+void set_intersection( const Map& a, const Map& b, Map& out ) // a's values
+{
+	set_combine( a, b, out, set_op_intersection, merge_keep() );
+}
+
+template<typename Map>
+void set_difference( const Map& a, const Map& b, Map& out ) // keys of a not in b
+{
+	set_combine( a, b, out, set_op_difference, merge_keep() );
+}
+
+#ifdef TST_HAS_THREADS
+// the same, with the characters of the top level split over threads;
+// each thread builds whole subtrees, the top level is linked at the end
+template<typename Map, typename Policy>
+void set_combine( const Map& a, const Map& b, Map& out, set_op op, Policy policy, unsigned threads )
+{
+	typedef __set_combiner<Map, Policy> combiner;
+	typedef typename Map::node_ptr node_ptr;
+
+	std::vector<node_ptr> pa, pb;
+	combiner::__pairs( a.root(), b.root(), pa, pb );
+	if ( threads < 1 )
+		threads = 1;
+	if ( threads > pa.size() )
+		threads = (unsigned)pa.size();
+
+	std::vector<node_ptr> res( pa.size(), node_ptr(0) );
+	std::vector<size_t> counts( threads, 0 );
+	std::vector<std::thread> workers;
+	for ( unsigned t = 0; t < threads; ++t )
+	{
+		workers.push_back( std::thread( [&, t]() {
+			combiner c( op, policy );
+			for ( size_t i = t; i < pa.size(); i += threads ) // interleaved, first
+				res[i] = c.node( pa[i], pb[i], counts[t] );    // characters vary most
+		} ) );
+	}
+	for ( size_t t = 0; t < workers.size(); ++t )
+	{
+		workers[t].join();
+	}
+
+	std::vector<node_ptr> top;
+	size_t n = 0;
+	for ( size_t i = 0; i < res.size(); ++i )
+	{
+		if ( res[i] )
+			top.push_back( res[i] );
+	}
+	for ( size_t t = 0; t < counts.size(); ++t )
+	{
+		n += counts[t];
+	}
+	tst_access::adopt( out, combiner::balance( top, 0, top.size() ), n );
+}
+
+template<typename Map>
+void set_union( const Map& a, const Map& b, Map& out, unsigned threads )
+{
+	set_combine( a, b, out, set_op_union, merge_replace(), threads );
+}
+
+template<typename Map>
+void set_intersection( const Map& a, const Map& b, Map& out, unsigned threads )
+{
+	set_combine( a, b, out, set_op_intersection, merge_keep(), threads );
+}
+
+template<typename Map>
+void set_difference( const Map& a, const Map& b, Map& out, unsigned threads )
+{
+	set_combine( a, b, out, set_op_difference, merge_keep(), threads );
+}
+#endif // TST_HAS_THREADS
+
+} // namespace tst
+
+#endif // TST_ALGORITHM_H
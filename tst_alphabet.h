@@ -0,0 +1,643 @@
+/*
+author: suninf
+description: alphabet policies for keys over a tiny fixed alphabet (DNA, hex,
+			 base64). tst_alpha_map replaces the splitchar BST of each tst_map
+			 level with a child array indexed by the symbol code, and
+			 packed_key packs short keys into 2/4/6-bit codes of one word with a
+			 bit-parallel Hamming distance, e.g. for k-mers kept in a
+			 tst_fixed_map<T, unsigned long long>; packed_key::nearsearch
+			 searches such a map and cuts every subtree whose known high
+			 bytes already differ in more than d symbols.
+
+			 a node keeps a bitmap of the codes present and a child array of
+			 just those, so a sparse base64 level costs no 64 null links.
+*/
+
+#ifndef TST_ALPHABET_H
+#define TST_ALPHABET_H
+
+#include <algorithm>
+#include <cstddef>
+#include "tst_map.h"
+#include "tst_fixed_map.h"
+
+namespace tst {
+
+inline int __alpha_popcount( unsigned long long w )
+{
+#if defined(__GNUC__)
+	return __builtin_popcountll( w );
+#else
+	int c = 0;
+	while ( w )
+	{
+		w &= w - 1;
+		++c;
+	}
+	return c;
+#endif
+}
+
+// an alphabet policy: size symbols, bits per packed symbol,
+// code(c) in [0, size) or -1 if c is not in the alphabet, symbol(code)
+struct dna_alphabet
+{
+	static const int size = 4;
+	static const int bits = 2;
+
+	static int code( char c )
+	{
+		switch ( c )
+		{
+		case 'A': case 'a': return 0;
+		case 'C': case 'c': return 1;
+		case 'G': case 'g': return 2;
+		case 'T': case 't': return 3;
+		default: return -1;
+		}
+	}
+
+	static char symbol( int i ) { return "ACGT"[i]; }
+};
+
+struct hex_alphabet
+{
+	static const int size = 16;
+	static const int bits = 4;
+
+	static int code( char c )
+	{
+		if ( c >= '0' && c <= '9' )
+			return c - '0';
+		if ( c >= 'a' && c <= 'f' )
+			return c - 'a' + 10;
+		if ( c >= 'A' && c <= 'F' )
+			return c - 'A' + 10;
+		return -1;
+	}
+
+	static char symbol( int i ) { return "0123456789abcdef"[i]; }
+};
+
+struct base64_alphabet
+{
+	static const int size = 64;
+	static const int bits = 6;
+
+	static int code( char c )
+	{
+		if ( c >= 'A' && c <= 'Z' )
+			return c - 'A';
+		if ( c >= 'a' && c <= 'z' )
+			return c - 'a' + 26;
+		if ( c >= '0' && c <= '9' )
+			return c - '0' + 52;
+		if ( c == '+' )
+			return 62;
+		if ( c == '/' )
+			return 63;
+		return -1;
+	}
+
+	static char symbol( int i )
+	{
+		return "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"[i];
+	}
+};
+
+// keys of up to capacity symbols packed into one word, first symbol highest
+template< typename Alphabet >
+struct packed_key
+{
+	typedef unsigned long long word;
+
+	static const size_t capacity = 64 / Alphabet::bits;
+
+	static bool pack( const char* s, size_t n, word& w ) // false if too long or not in the alphabet
+	{
+		if ( n > capacity )
+			return false;
+		w = 0;
+		for ( size_t i = 0; i < n; ++i )
+		{
+			int c = Alphabet::code( s[i] );
+			if ( c < 0 )
+				return false;
+			w = (w << Alphabet::bits) | (word)c;
+		}
+		return true;
+	}
+
+	static std::string unpack( word w, size_t n )
+	{
+		std::string str( n, ' ' );
+		for ( size_t i = n; i > 0; --i )
+		{
+			str[i-1] = Alphabet::symbol( (int)(w & ((1u << Alphabet::bits) - 1)) );
+			w >>= Alphabet::bits;
+		}
+		return str;
+	}
+
+	// number of different symbols of two packed keys of n symbols:
+	// fold every symbol's xor bits onto its lowest bit, then count them
+	static int hamming( word a, word b, size_t n )
+	{
+		word diff = a ^ b;
+		word any = diff;
+		for ( int k = 1; k < Alphabet::bits; ++k )
+		{
+			any |= diff >> k;
+		}
+		return __alpha_popcount( any & __low_bits( n ) );
+	}
+
+	// pair( key, value ) of the keys of m, all packed from n symbols, that
+	// differ from the packed query q in at most d symbols, in key order
+	template< typename T, typename Traits, typename Seq >
+	static void nearsearch( const tst_fixed_map<T, word, Traits>& m, word q, size_t n, int d, Seq& c )
+	{
+		c.clear();
+		__near_search( m.root(), 0, 0, q, n, d, c );
+	}
+
+private:
+	// bytes [0, i] of the key below p are known; a symbol that differs in
+	// them differs in every key of the subtree
+	template< typename T, typename Seq >
+	static void __near_search( tnode<T, unsigned char>* p, size_t i, word prefix, word q,
+		size_t n, int d, Seq& c )
+	{
+		if ( !p )
+			return;
+		__near_search( p->lokid, i, prefix, q, n, d, c );
+
+		size_t shift = 8 * ( sizeof(word) - 1 - i );
+		word w = prefix | ( (word)p->splitchar << shift );
+		if ( hamming( w, q & ( ~(word)0 << shift ), n ) <= d )
+		{
+			if ( i + 1 < sizeof(word) )
+				__near_search( p->eqkid, i + 1, w, q, n, d, c );
+			else if ( p->pdata )
+				c.push_back( std::make_pair( w, *(p->pdata) ) );
+		}
+
+		__near_search( p->hikid, i, prefix, q, n, d, c );
+	}
+
+	static word __low_bits( size_t n ) // the lowest bit of each of n symbols
+	{
+		word m = 0;
+		for ( size_t i = 0; i < n; ++i )
+		{
+			m = (m << Alphabet::bits) | 1;
+		}
+		return m;
+	}
+};
+
+// kids holds a link for each bit set in codes, in code order, so the kid of
+// code c is kids[ popcount of the codes below c ]
+template< typename T, int Size >
+struct alpha_tnode
+{
+	typedef alpha_tnode* node_ptr;
+	typedef char __size_check[ Size <= 64 ? 1 : -1 ]; // codes fit the bitmap
+
+	alpha_tnode() : codes(0), kids(0), pdata(0) {}
+
+	~alpha_tnode()
+	{
+		delete [] kids;
+	}
+
+	node_ptr kid( int c ) const // 0 if absent
+	{
+		unsigned long long b = 1ULL << c;
+		return ( codes & b ) ? kids[ __alpha_popcount( codes & (b - 1) ) ] : 0;
+	}
+
+	node_ptr& link( int c ) // the kid of code c, a null one added if absent
+	{
+		unsigned long long b = 1ULL << c;
+		int r = __alpha_popcount( codes & (b - 1) );
+		if ( !( codes & b ) )
+		{
+			int n = __alpha_popcount( codes );
+			node_ptr* grown = new node_ptr[ n + 1 ];
+			std::copy( kids, kids + r, grown );
+			grown[r] = 0;
+			std::copy( kids + r, kids + n, grown + r + 1 );
+			delete [] kids;
+			kids = grown;
+			codes |= b;
+		}
+		return kids[r];
+	}
+
+	void unlink( int c ) // drop the kid of code c from the array, not freed
+	{
+		unsigned long long b = 1ULL << c;
+		if ( !( codes & b ) )
+			return;
+		int r = __alpha_popcount( codes & (b - 1) );
+		int n = __alpha_popcount( codes );
+		node_ptr* shrunk = n > 1 ? new node_ptr[ n - 1 ] : 0;
+		std::copy( kids, kids + r, shrunk );
+		std::copy( kids + r + 1, kids + n, shrunk + r );
+		delete [] kids;
+		kids = shrunk;
+		codes &= ~b;
+	}
+
+	unsigned long long codes;
+	node_ptr* kids;
+	T* pdata;
+
+private:
+	alpha_tnode( const alpha_tnode& );
+	alpha_tnode& operator = ( const alpha_tnode& );
+};
+
+// keys with a symbol outside the alphabet are never stored, insert returns 0
+template<typename T, typename Alphabet, typename Ch = char>
+class tst_alpha_map
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef alpha_tnode<T, Alphabet::size>* node_ptr;
+	typedef tstring key_type;
+
+	typedef T value_type;
+	typedef T& reference;
+	typedef T* pointer;
+	typedef T const& const_reference;
+	typedef T const* const_pointer;
+
+public:
+	tst_alpha_map()
+		: root_(0), size_(0) {}
+
+	tst_alpha_map( const tst_alpha_map& m )
+		: root_(0), size_(0)
+	{
+		m.foreach( __insert_helper(*this) );
+	}
+
+	template<typename Iter>
+	tst_alpha_map( Iter beg, Iter end )
+		: root_(0), size_(0)
+	{
+		insert( beg, end );
+	}
+
+	tst_alpha_map& operator = ( const tst_alpha_map& m )
+	{
+		if ( this != &m )
+		{
+			clear();
+			m.foreach( __insert_helper(*this) );
+		}
+		return *this;
+	}
+
+	~tst_alpha_map()
+	{
+		__destroy( root_ );
+	}
+
+	pointer insert( const tstring& str, const T& val )// may be just update if exist
+	{
+		node_ptr p = __make_path( str.c_str() );
+		if ( !p )
+			return 0;
+		if ( p->pdata )
+			*(p->pdata) = val;
+		else
+		{
+			++size_;
+			p->pdata = new T( val );
+		}
+		return p->pdata;
+	}
+
+	template<typename Iter>
+	void insert( Iter beg, Iter end ) // insert [beg, end), value_type: pair<string, T>
+	{
+		while ( beg != end )
+		{
+			insert( beg->first, beg->second );
+			++beg;
+		}
+	}
+
+	pointer insert( const std::pair<tstring, T>& pair_val )
+	{
+		return insert( pair_val.first, pair_val.second );
+	}
+
+	pointer find( const tstring& str ) { return __find( str.c_str() ); }
+
+	const_pointer find( const tstring& str ) const { return __find( str.c_str() ); }
+
+	reference operator[]( const tstring& str ) // str must be in the alphabet
+	{
+		return *__slot( str.c_str() );
+	}
+
+	const T operator[]( const tstring& str ) const
+	{
+		const T* pos = find(str);
+		return pos ? *pos : T();
+	}
+
+	bool remove( const tstring& str ) // nodes left without any key are freed
+	{
+		if ( !root_ || str.empty() || !__remove( root_, str.c_str() ) )
+			return false;
+		if ( root_->codes == 0 )
+		{
+			delete root_;
+			root_ = 0;
+		}
+		return true;
+	}
+
+	bool erase( const tstring& str ) { return remove(str); }
+
+	void clear()
+	{
+		__destroy( root_ );
+	}
+
+	void swap( tst_alpha_map& m )
+	{
+		std::swap( root_, m.root_ );
+		std::swap( size_, m.size_ );
+	}
+
+	size_t size() const { return size_; }
+
+	bool empty() const { return size_==0; }
+
+	template<typename Func>
+	void foreach( Func f ) // in symbol code order
+	{
+		tstring str;
+		__travel( root_, str, f );
+	}
+
+	template<typename Func>
+	void foreach( Func f ) const
+	{
+		tstring str;
+		__travel( root_, str, f );
+	}
+
+	template< typename Seq > // value_type: pair<string, T>
+	void sequence( Seq& c ) const
+	{
+		c.clear();
+		foreach( __push_back<Seq>(c) );
+	}
+
+	template< typename Seq >
+	void nearsearch( const tstring& str, int d, Seq& c ) const // at most d different symbols
+	{
+		tstring strtmp;
+		c.clear();
+		if ( root_ )
+			__near_search( root_, str.c_str(), d, strtmp, c );
+	}
+
+	template< typename Seq >
+	void pmsearch( const tstring& str, Seq& c ) const // partial-match, '.' any symbol
+	{
+		tstring strtmp;
+		c.clear();
+		if ( root_ && !str.empty() )
+			__pmsearch( root_, str.c_str(), strtmp, c );
+	}
+
+private: // inner use for implement
+	// root_ stands for the empty prefix, the kids of a node are indexed by
+	// the code of the next symbol
+	node_ptr __node( const Ch* s ) const
+	{
+		if ( *s == 0 )
+			return 0;
+		node_ptr p = root_;
+		while ( p && *s )
+		{
+			int c = Alphabet::code( *s++ );
+			if ( c < 0 )
+				return 0;
+			p = p->kid( c );
+		}
+		return p;
+	}
+
+	pointer __find( const Ch* s ) const
+	{
+		node_ptr p = __node( s );
+		return p ? p->pdata : 0;
+	}
+
+	pointer __slot( const Ch* s ) // for operator[]
+	{
+		node_ptr p = __make_path( s );
+		if ( !p )
+			return 0;
+		if ( p->pdata == 0 )
+		{
+			++size_;
+			p->pdata = new T();
+		}
+		return p->pdata;
+	}
+
+	node_ptr __make_path( const Ch* s ) // the node of s, 0 if s is empty or not in the alphabet
+	{
+		if ( *s == 0 )
+			return 0;
+		for ( const Ch* q = s; *q; ++q )
+		{
+			if ( Alphabet::code( *q ) < 0 )
+				return 0;
+		}
+
+		if ( root_ == 0 )
+			root_ = new alpha_tnode<T, Alphabet::size>();
+		node_ptr p = root_;
+		while ( *s )
+		{
+			node_ptr& kid = p->link( Alphabet::code( *s++ ) );
+			if ( kid == 0 )
+				kid = new alpha_tnode<T, Alphabet::size>();
+			p = kid;
+		}
+		return p;
+	}
+
+	// removes s below p, the node of the symbols before s; a kid left with
+	// no value and no kids is unlinked and freed on the way back
+	bool __remove( node_ptr p, const Ch* s )
+	{
+		int c = Alphabet::code( *s );
+		node_ptr kid = c < 0 ? 0 : p->kid( c );
+		if ( !kid )
+			return false;
+		if ( *(s+1) == 0 )
+		{
+			if ( !kid->pdata )
+				return false;
+			delete kid->pdata;
+			kid->pdata = 0;
+			--size_;
+		}
+		else if ( !__remove( kid, s+1 ) )
+			return false;
+
+		if ( !kid->pdata && kid->codes == 0 )
+		{
+			p->unlink( c );
+			delete kid;
+		}
+		return true;
+	}
+
+	template< typename Seq >
+	void __pmsearch( node_ptr p, const Ch* s, tstring& cur_str, Seq& c ) const
+	{
+		int want = *s == '.' ? -1 : Alphabet::code( *s );
+		if ( want < 0 && *s != '.' )
+			return;
+
+		for ( int i = 0, j = 0; i < Alphabet::size; ++i )
+		{
+			if ( !( p->codes >> i & 1 ) )
+				continue;
+			node_ptr kid = p->kids[j++];
+			if ( want >= 0 && i != want )
+				continue;
+
+			cur_str.push_back( Alphabet::symbol(i) );
+			if ( *(s+1) == 0 && kid->pdata )
+			{
+				c.push_back( std::make_pair( cur_str, *(kid->pdata) ) );
+			}
+			else if ( *(s+1) )
+			{
+				__pmsearch( kid, s+1, cur_str, c );
+			}
+			cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		}
+	}
+
+	template< typename Seq >
+	void __near_search( node_ptr p, const Ch* s, int d, tstring& cur_str, Seq& seq ) const
+	{
+		int want = *s ? Alphabet::code( *s ) : -1;
+		for ( int i = 0, j = 0; i < Alphabet::size; ++i )
+		{
+			if ( !( p->codes >> i & 1 ) )
+				continue;
+			node_ptr kid = p->kids[j++];
+			int nd = ( i == want ) ? d : d-1;
+			if ( nd < 0 )
+				continue;
+
+			cur_str.push_back( Alphabet::symbol(i) );
+			const Ch* next = *s ? s+1 : s;
+			if ( kid->pdata && __strlen(next) <= nd )
+			{
+				seq.push_back( std::make_pair( cur_str, *(kid->pdata) ) );
+			}
+			__near_search( kid, next, nd, cur_str, seq );
+			cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		}
+	}
+
+	template< typename Func >
+	static void __travel( node_ptr p, tstring& cur_str, Func& f )
+	{
+		if ( !p )
+			return;
+		for ( int i = 0, j = 0; i < Alphabet::size; ++i )
+		{
+			if ( !( p->codes >> i & 1 ) )
+				continue;
+			node_ptr kid = p->kids[j++];
+			cur_str.push_back( Alphabet::symbol(i) );
+			if ( kid->pdata )
+			{
+				f( (const tstring&)cur_str, *(kid->pdata) );
+			}
+			__travel( kid, cur_str, f );
+			cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		}
+	}
+
+	void __destroy( node_ptr& p )
+	{
+		if ( p==0 )
+			return;
+		for ( int j = __alpha_popcount( p->codes ); j > 0; --j )
+		{
+			__destroy( p->kids[j-1] );
+		}
+		if ( p->pdata )
+		{
+			delete p->pdata;
+			p->pdata = 0;
+			--size_;
+		}
+		delete p;
+		p = 0;
+	}
+
+	template< typename Seq >
+	struct __push_back
+	{
+		Seq& seq_;
+		__push_back( Seq& s ) : seq_(s) {}
+		void operator()( const tstring& str, const T& t )
+		{
+			seq_.push_back( std::make_pair( str, t ) );
+		}
+	};
+
+	struct __insert_helper
+	{
+		tst_alpha_map& m_;
+		__insert_helper( tst_alpha_map& m ) : m_(m) {}
+		void operator()( const tstring& str, const T& t )
+		{
+			m_.insert( str, t );
+		}
+	};
+
+	static int __strlen( const Ch* s )
+	{
+		int len = 0;
+		while ( *s++ )
+		{
+			++len;
+		}
+		return len;
+	}
+
+private:
+	node_ptr root_;
+	size_t size_;
+};
+
+template<typename T, typename Alphabet, typename Ch>
+void swap( tst_alpha_map<T, Alphabet, Ch>& lhs, tst_alpha_map<T, Alphabet, Ch>& rhs )
+{
+	lhs.swap( rhs );
+}
+
+} // namespace tst
+
+#endif // TST_ALPHABET_H
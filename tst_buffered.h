@@ -0,0 +1,130 @@
+/*
+author: suninf
+description: buffered writes into a tst_map shared by many threads. Each
+			 writer thread owns a tst_buffered_writer, which collects its
+			 inserts in a small private tst_map with no locking. A flush
+			 splices the buffer into the shared map with tst_map::merge,
+			 so whole subtrees absent there are linked in, not inserted key
+			 by key, and a thread takes the lock once per flush, not once
+			 per key.
+
+			 tst::tst_shared_map< tst::tst_map<int> > shared;
+			 tst::tst_buffered_writer< tst::tst_map<int>, tst::merge_add > w( shared );
+			 w.insert( "word", 1 ); // flushed every limit keys, and at the end
+
+			 Policy combines values of one key, as merge( mine, theirs ),
+			 both within a buffer and into the shared map. Writes become
+			 visible to readers at the flush. Needs C++11 threads.
+*/
+
+#ifndef TST_BUFFERED_H
+#define TST_BUFFERED_H
+
+#include <mutex>
+#include "tst_map.h"
+
+namespace tst {
+
+// a Map behind a mutex, written by merging whole buffers
+template<typename Map>
+class tst_shared_map
+{
+public:
+	typedef typename Map::tstring tstring;
+	typedef typename Map::value_type value_type;
+
+public:
+	tst_shared_map() {}
+
+	tst_shared_map( const tst_shared_map& ) = delete;
+	tst_shared_map& operator = ( const tst_shared_map& ) = delete;
+
+	// moves every entry of buf into the map, buf is left empty
+	template<typename Policy>
+	void absorb( Map& buf, Policy policy )
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		map_.merge( buf, policy );
+	}
+
+	template<typename Func>
+	void read( Func f ) const // f( const Map& ) under the lock
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		f( (const Map&)map_ );
+	}
+
+	bool find( const tstring& str, value_type& val ) const
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		typename Map::const_pointer p = ( (const Map&)map_ ).find( str );
+		if ( p )
+			val = *p;
+		return p != 0;
+	}
+
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		return map_.size();
+	}
+
+	Map& unsafe_map() { return map_; } // when no writer runs
+
+private:
+	mutable std::mutex mutex_;
+	Map map_;
+};
+
+// one per writer thread, not thread-safe itself
+template<typename Map, typename Policy = merge_replace>
+class tst_buffered_writer
+{
+public:
+	typedef typename Map::tstring tstring;
+	typedef typename Map::value_type value_type;
+
+public:
+	// flushes once the buffer holds limit keys
+	explicit tst_buffered_writer( tst_shared_map<Map>& target, size_t limit = 4096,
+		Policy policy = Policy() )
+		: target_(target), limit_(limit ? limit : 1), policy_(policy), flushes_(0) {}
+
+	~tst_buffered_writer()
+	{
+		flush();
+	}
+
+	tst_buffered_writer( const tst_buffered_writer& ) = delete;
+	tst_buffered_writer& operator = ( const tst_buffered_writer& ) = delete;
+
+	void insert( const tstring& str, const value_type& val )
+	{
+		buf_.upsert( str, val, policy_ );
+		if ( buf_.size() >= limit_ )
+			flush();
+	}
+
+	void flush() // the buffer into the shared map, one critical section
+	{
+		if ( buf_.empty() )
+			return;
+		target_.absorb( buf_, policy_ );
+		++flushes_;
+	}
+
+	size_t pending() const { return buf_.size(); } // keys not flushed yet
+
+	size_t flushes() const { return flushes_; }
+
+private:
+	tst_shared_map<Map>& target_;
+	size_t limit_;
+	Policy policy_;
+	Map buf_;
+	size_t flushes_;
+};
+
+} // namespace tst
+
+#endif // TST_BUFFERED_H
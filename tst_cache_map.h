@@ -0,0 +1,319 @@
+/*
+author: suninf
+description: tst_cache_map is a bounded tst_map for caching per-key results.
+			 It keeps at most an entry budget and/or an estimated byte budget;
+			 insert evicts entries chosen by the eviction policy, prunes their
+			 nodes from the tree and reports them to an eviction callback.
+			 lru_policy: an intrusive recency list; lfu_policy: GCLOCK, a clock
+			 hand over per-entry frequency counters, approximating LFU.
+
+			 entries live in a tst_linked_map, so an evicted entry is erased
+			 through the parent links of its node and no key is kept per
+			 entry; the key is spelled only for the eviction callback.
+*/
+
+#ifndef TST_CACHE_MAP_H
+#define TST_CACHE_MAP_H
+
+#include "tst_map.h"
+#include "tst_linked_map.h"
+
+namespace tst {
+
+// per-entry bookkeeping of the eviction policies, a circular list
+struct cache_links
+{
+	cache_links() : prev(this), next(this), freq(0) {}
+
+	cache_links* prev;
+	cache_links* next;
+	unsigned freq;
+
+	void link_before( cache_links* pos )
+	{
+		prev = pos->prev;
+		next = pos;
+		pos->prev->next = this;
+		pos->prev = this;
+	}
+
+	void unlink()
+	{
+		prev->next = next;
+		next->prev = prev;
+		prev = next = this;
+	}
+};
+
+class lru_policy // most recently used first
+{
+public:
+	void insert( cache_links* e ) { e->link_before( head_.next ); }
+
+	void touch( cache_links* e )
+	{
+		e->unlink();
+		insert( e );
+	}
+
+	void erase( cache_links* e ) { e->unlink(); }
+
+	cache_links* victim() // 0 if empty
+	{
+		return head_.prev == &head_ ? 0 : head_.prev;
+	}
+
+	void clear() { head_.prev = head_.next = &head_; }
+
+private:
+	cache_links head_;
+};
+
+class lfu_policy // GCLOCK: the hand decrements counters, evicts at zero
+{
+public:
+	enum { max_freq = 15 };
+
+	lfu_policy() : hand_(&head_) {}
+
+	void insert( cache_links* e )
+	{
+		e->freq = 1;
+		e->link_before( hand_ ); // just behind the hand, visited last
+	}
+
+	void touch( cache_links* e )
+	{
+		if ( e->freq < max_freq )
+			++e->freq;
+	}
+
+	void erase( cache_links* e )
+	{
+		if ( hand_ == e )
+			hand_ = e->next;
+		e->unlink();
+	}
+
+	cache_links* victim() // 0 if empty
+	{
+		if ( head_.next == &head_ )
+			return 0;
+		while ( true )
+		{
+			if ( hand_ == &head_ )
+				hand_ = head_.next;
+			if ( hand_->freq == 0 )
+				return hand_;
+			--hand_->freq;
+			hand_ = hand_->next;
+		}
+	}
+
+	void clear()
+	{
+		head_.prev = head_.next = &head_;
+		hand_ = &head_;
+	}
+
+private:
+	cache_links head_;
+	cache_links* hand_;
+};
+
+struct no_evict_callback
+{
+	template<typename Str, typename U>
+	void operator()( const Str&, U& ) {}
+};
+
+// OnEvict is called as f( key, value ) right before an entry is evicted
+template<typename T, typename Ch = char, typename Comp = std::less<Ch>,
+	typename Policy = lru_policy, typename OnEvict = no_evict_callback>
+class tst_cache_map
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef tstring key_type;
+
+	typedef T value_type;
+	typedef T& reference;
+	typedef T* pointer;
+	typedef T const& const_reference;
+	typedef T const* const_pointer;
+
+public:
+	// a budget of 0 means unbounded
+	explicit tst_cache_map( size_t max_entries, size_t max_bytes = 0, OnEvict f = OnEvict() )
+		: max_entries_(max_entries), max_bytes_(max_bytes), bytes_(0), on_evict_(f) {}
+
+	pointer insert( const tstring& str, const T& val )// may be just update if exist
+	{
+		__entry* e = __slot( str );
+		if ( !e )
+			return 0;
+		e->value = val;
+		__shrink( e );
+		return &e->value;
+	}
+
+	pointer find( const tstring& str ) // counts as a use of the entry
+	{
+		__entry* e = map_.find( str );
+		if ( !e )
+			return 0;
+		policy_.touch( e );
+		return &e->value;
+	}
+
+	const_pointer peek( const tstring& str ) const // no effect on eviction order
+	{
+		const __entry* e = map_.find( str );
+		return e ? &e->value : 0;
+	}
+
+	reference operator[]( const tstring& str ) // str must not be empty
+	{
+		__entry* e = __slot( str );
+		__shrink( e );
+		return e->value;
+	}
+
+	bool remove( const tstring& str )
+	{
+		__entry* e = map_.find( str );
+		if ( !e )
+			return false;
+		__drop( e );
+		return true;
+	}
+
+	bool erase( const tstring& str ) { return remove(str); }
+
+	void clear() // no eviction callbacks
+	{
+		policy_.clear();
+		map_.clear();
+		bytes_ = 0;
+	}
+
+	// evict until both budgets are met; returns the number evicted
+	size_t set_budget( size_t max_entries, size_t max_bytes = 0 )
+	{
+		max_entries_ = max_entries;
+		max_bytes_ = max_bytes;
+		return __shrink( 0 );
+	}
+
+	size_t size() const { return map_.size(); }
+
+	bool empty() const { return map_.empty(); }
+
+	// estimated bytes held: entries plus one node per key character
+	size_t bytes() const { return bytes_; }
+
+	template<typename Func>
+	void foreach( Func f ) const // f( const tstring&, const T& )
+	{
+		map_.foreach( __value_call<Func>(f) );
+	}
+
+private: // inner use for implement
+	struct __entry : cache_links
+	{
+		T value;
+		size_t weight; // its share of bytes_
+	};
+
+	typedef tst_linked_map<__entry, Ch, Comp> entry_map;
+
+	static size_t __weight( const tstring& str ) // the entry, its owner link, its nodes
+	{
+		return sizeof(__entry) + sizeof(typename entry_map::node_ptr)
+			+ str.size() * sizeof(typename entry_map::node_type);
+	}
+
+	__entry* __slot( const tstring& str ) // find or create, touches the entry
+	{
+		if ( str.empty() )
+			return 0;
+		size_t n = map_.size();
+		__entry* e = &map_[str];
+		if ( map_.size() != n )
+		{
+			e->weight = __weight( str );
+			bytes_ += e->weight;
+			policy_.insert( e );
+		}
+		else
+			policy_.touch( e );
+		return e;
+	}
+
+	bool __over() const
+	{
+		return ( max_entries_ && map_.size() > max_entries_ )
+			|| ( max_bytes_ && bytes_ > max_bytes_ );
+	}
+
+	size_t __shrink( __entry* keep ) // keep: the entry being inserted
+	{
+		size_t n = 0;
+		while ( __over() )
+		{
+			__entry* e = static_cast<__entry*>( policy_.victim() );
+			if ( e == keep )
+			{// spare the new entry unless it is the only one left
+				if ( map_.size() == 1 )
+					break;
+				policy_.touch( e );
+				continue;
+			}
+			__evicted( on_evict_, e );
+			__drop( e );
+			++n;
+		}
+		return n;
+	}
+
+	template<typename F>
+	void __evicted( F& f, __entry* e )
+	{
+		f( (const tstring&)map_.key_of( e ), e->value );
+	}
+
+	void __evicted( no_evict_callback&, __entry* ) {} // no key to spell
+
+	void __drop( __entry* e )
+	{
+		policy_.erase( e );
+		bytes_ -= e->weight;
+		map_.erase( map_.handle_of( e ) );
+	}
+
+	template< typename Func >
+	struct __value_call
+	{
+		Func f_;
+		__value_call( Func f ) : f_(f) {}
+		void operator()( const tstring& str, const __entry& e )
+		{
+			f_( str, e.value );
+		}
+	};
+
+	tst_cache_map( const tst_cache_map& ); // entries are linked, not copyable
+	tst_cache_map& operator = ( const tst_cache_map& );
+
+private:
+	entry_map map_;
+	Policy policy_;
+	size_t max_entries_;
+	size_t max_bytes_;
+	size_t bytes_;
+	OnEvict on_evict_;
+};
+
+} // namespace tst
+
+#endif // TST_CACHE_MAP_H
@@ -0,0 +1,374 @@
+/*
+author: suninf
+description: value columns for the flat format (tst_flat.h). A column policy
+			 encodes the values of a flat file, in key order, into one region
+			 and decodes slot i on access.
+			 raw_column<T>:             T as is, trivially copyable T
+			 bitpacked_column<T>:       integers as offsets from the minimum,
+										in just enough bits for the range
+			 string_pool_column<Str>:   each distinct string stored once,
+										values are bitpacked indices into them
+
+			 encoder: add( tmp, v ) while keys are added, with tmp a scratch
+					  file; write( tmp, out, n, bytes ) at the end, tmp rewound.
+			 decoder: open( p, bytes, n ) over the mapped region; get( i ).
+*/
+
+#ifndef TST_COLUMN_H
+#define TST_COLUMN_H
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace tst {
+
+enum { column_raw = 0, column_bitpacked = 1, column_string_pool = 2 };
+
+inline unsigned int __bit_width( unsigned long long x ) // bits to hold x
+{
+	unsigned int n = 0;
+	while ( x )
+	{
+		++n;
+		x >>= 1;
+	}
+	return n;
+}
+
+// width bit values packed into 64-bit words, low bits first
+class __bit_packer
+{
+public:
+	__bit_packer( std::FILE* out, unsigned int width )
+		: out_(out), width_(width), cur_(0), used_(0), words_(0), ok_(true) {}
+
+	void put( unsigned long long v )
+	{
+		if ( width_ == 0 )
+			return;
+		cur_ |= v << used_;
+		if ( used_ + width_ >= 64 )
+		{
+			__word( cur_ );
+			unsigned int spilled = used_ + width_ - 64; // bits of v left over
+			cur_ = spilled ? v >> ( width_ - spilled ) : 0;
+			used_ = spilled;
+		}
+		else
+			used_ += width_;
+	}
+
+	bool finish() // the last partial word, and one spare so reads may take two
+	{
+		if ( used_ )
+			__word( cur_ );
+		__word( 0 );
+		return ok_;
+	}
+
+	unsigned long long bytes() const { return words_ * 8; }
+
+private:
+	void __word( unsigned long long w )
+	{
+		ok_ = ok_ && std::fwrite( &w, sizeof(w), 1, out_ ) == 1;
+		++words_;
+	}
+
+	std::FILE* out_;
+	unsigned int width_;
+	unsigned long long cur_;
+	unsigned int used_;
+	unsigned long long words_;
+	bool ok_;
+};
+
+inline unsigned long long __bit_get( const unsigned long long* words, unsigned int width,
+	unsigned long long i )
+{
+	if ( width == 0 )
+		return 0;
+	unsigned long long bit = i * width;
+	unsigned int off = (unsigned int)( bit & 63 );
+	const unsigned long long* w = words + ( bit >> 6 );
+	unsigned long long v = w[0] >> off;
+	if ( off + width > 64 )
+		v |= w[1] << ( 64 - off );
+	return width == 64 ? v : v & ( ( (unsigned long long)1 << width ) - 1 );
+}
+
+// reads the n values of type U written to tmp, calling f( v ) on each
+template<typename U, typename Func>
+bool __read_scratch( std::FILE* tmp, unsigned long long n, Func& f )
+{
+	U buf[1024];
+	while ( n > 0 )
+	{
+		size_t k = (size_t)( n < 1024 ? n : 1024 );
+		if ( std::fread( buf, sizeof(U), k, tmp ) != k )
+			return false;
+		for ( size_t i = 0; i < k; ++i )
+		{
+			f( buf[i] );
+		}
+		n -= k;
+	}
+	return true;
+}
+
+template<typename T>
+struct raw_column
+{
+	typedef T value_type;
+	typedef const T& result_type;
+	enum { kind = column_raw };
+
+	class encoder
+	{
+	public:
+		bool add( std::FILE* tmp, const T& v ) { return std::fwrite( &v, sizeof(T), 1, tmp ) == 1; }
+
+		bool write( std::FILE* tmp, std::FILE* out, unsigned long long n, unsigned long long& bytes )
+		{
+			bytes = n * sizeof(T);
+			char buf[1 << 16];
+			unsigned long long left = bytes;
+			while ( left > 0 )
+			{
+				size_t k = (size_t)( left < sizeof(buf) ? left : sizeof(buf) );
+				if ( std::fread( buf, 1, k, tmp ) != k || std::fwrite( buf, 1, k, out ) != k )
+					return false;
+				left -= k;
+			}
+			return true;
+		}
+	};
+
+	class decoder
+	{
+	public:
+		decoder() : p_(0) {}
+
+		bool open( const char* p, unsigned long long bytes, unsigned long long n )
+		{
+			p_ = (const T*)p;
+			return bytes / sizeof(T) >= n;
+		}
+
+		result_type get( unsigned long long i ) const { return p_[i]; }
+
+		const T* pointer( unsigned long long i ) const { return p_ + i; }
+
+	private:
+		const T* p_;
+	};
+};
+
+// T an integer type
+template<typename T>
+struct bitpacked_column
+{
+	typedef T value_type;
+	typedef T result_type;
+	enum { kind = column_bitpacked };
+
+	struct header
+	{
+		unsigned long long min;
+		unsigned long long width;
+	};
+
+	class encoder
+	{
+	public:
+		encoder() : min_(0), max_(0), any_(false) {}
+
+		bool add( std::FILE* tmp, const T& v )
+		{
+			if ( !any_ || v < min_ )
+				min_ = v;
+			if ( !any_ || max_ < v )
+				max_ = v;
+			any_ = true;
+			return std::fwrite( &v, sizeof(T), 1, tmp ) == 1;
+		}
+
+		bool write( std::FILE* tmp, std::FILE* out, unsigned long long n, unsigned long long& bytes )
+		{
+			header h;
+			h.min = (unsigned long long)min_;
+			h.width = __bit_width( (unsigned long long)max_ - (unsigned long long)min_ );
+			if ( std::fwrite( &h, sizeof(h), 1, out ) != 1 )
+				return false;
+			__bit_packer bp( out, (unsigned int)h.width );
+			__pack f( bp, h.min );
+			bool ok = __read_scratch<T>( tmp, n, f ) && bp.finish();
+			bytes = sizeof(h) + bp.bytes();
+			return ok;
+		}
+
+	private:
+		struct __pack
+		{
+			__bit_packer& bp_;
+			unsigned long long min_;
+			__pack( __bit_packer& bp, unsigned long long min ) : bp_(bp), min_(min) {}
+			void operator()( const T& v ) { bp_.put( (unsigned long long)v - min_ ); }
+		};
+
+		T min_, max_;
+		bool any_;
+	};
+
+	class decoder
+	{
+	public:
+		decoder() : words_(0) {}
+
+		bool open( const char* p, unsigned long long bytes, unsigned long long n )
+		{
+			if ( bytes < sizeof(header) )
+				return false;
+			std::memcpy( &h_, p, sizeof(h_) );
+			words_ = (const unsigned long long*)( p + sizeof(header) );
+			return h_.width <= 64 && ( bytes - sizeof(header) ) / 8 >= ( n * h_.width + 63 ) / 64 + 1;
+		}
+
+		result_type get( unsigned long long i ) const
+		{
+			return (T)( h_.min + __bit_get( words_, (unsigned int)h_.width, i ) );
+		}
+
+	private:
+		header h_;
+		const unsigned long long* words_;
+	};
+};
+
+// Str a basic_string; the distinct strings must fit in memory while writing
+template<typename Str>
+struct string_pool_column
+{
+	typedef Str value_type;
+	typedef Str result_type;
+	typedef typename Str::value_type char_type;
+	enum { kind = column_string_pool };
+
+	// u64 count, u64 width, u64 offsets[count+1] in characters, the
+	// characters padded to 8 bytes, then the indices bitpacked
+	class encoder
+	{
+	public:
+		bool add( std::FILE* tmp, const Str& v )
+		{
+			typename std::map<Str, unsigned long long>::iterator it = ids_.find( v );
+			if ( it == ids_.end() )
+			{
+				it = ids_.insert( std::make_pair( v, (unsigned long long)order_.size() ) ).first;
+				order_.push_back( &it->first );
+			}
+			return std::fwrite( &it->second, sizeof(it->second), 1, tmp ) == 1;
+		}
+
+		bool write( std::FILE* tmp, std::FILE* out, unsigned long long n, unsigned long long& bytes )
+		{
+			std::vector<unsigned long long> head;
+			head.push_back( order_.size() );
+			head.push_back( __bit_width( order_.empty() ? 0 : order_.size() - 1 ) );
+			unsigned long long off = 0;
+			head.push_back( off );
+			for ( size_t i = 0; i < order_.size(); ++i )
+			{
+				off += order_[i]->size();
+				head.push_back( off );
+			}
+			bool ok = std::fwrite( &head[0], 8, head.size(), out ) == head.size();
+			for ( size_t i = 0; ok && i < order_.size(); ++i )
+			{
+				size_t k = order_[i]->size();
+				ok = k == 0 || std::fwrite( order_[i]->data(), sizeof(char_type), k, out ) == k;
+			}
+			unsigned long long chars = off * sizeof(char_type);
+			static const char zeros[8] = { 0 };
+			size_t pad = (size_t)( ( 8 - chars % 8 ) % 8 );
+			ok = ok && ( pad == 0 || std::fwrite( zeros, 1, pad, out ) == pad );
+
+			__bit_packer bp( out, (unsigned int)head[1] );
+			__pack f( bp );
+			ok = ok && __read_scratch<unsigned long long>( tmp, n, f ) && bp.finish();
+			bytes = head.size() * 8 + chars + pad + bp.bytes();
+			return ok;
+		}
+
+	private:
+		struct __pack
+		{
+			__bit_packer& bp_;
+			__pack( __bit_packer& bp ) : bp_(bp) {}
+			void operator()( unsigned long long id ) { bp_.put( id ); }
+		};
+
+		std::map<Str, unsigned long long> ids_;
+		std::vector<const Str*> order_; // by index
+	};
+
+	class decoder
+	{
+	public:
+		decoder() : count_(0), width_(0), offsets_(0), chars_(0), words_(0) {}
+
+		bool open( const char* p, unsigned long long bytes, unsigned long long n )
+		{
+			if ( bytes < 16 )
+				return false;
+			std::memcpy( &count_, p, 8 );
+			std::memcpy( &width_, p + 8, 8 );
+			if ( width_ > 64 || ( bytes - 16 ) / 8 < count_ + 1 )
+				return false;
+			offsets_ = (const unsigned long long*)( p + 16 );
+			unsigned long long chars = offsets_[count_] * sizeof(char_type);
+			unsigned long long used = 16 + ( count_ + 1 ) * 8 + ( chars + 7 ) / 8 * 8;
+			if ( used > bytes )
+				return false;
+			chars_ = (const char_type*)( p + 16 + ( count_ + 1 ) * 8 );
+			words_ = (const unsigned long long*)( p + used );
+			return ( bytes - used ) / 8 >= ( n * width_ + 63 ) / 64 + 1;
+		}
+
+		result_type get( unsigned long long i ) const
+		{
+			const char_type* s;
+			size_t len;
+			view( i, s, len );
+			return Str( s, len );
+		}
+
+		// the characters of value i, without a copy
+		void view( unsigned long long i, const char_type*& s, size_t& len ) const
+		{
+			unsigned long long id = id_of( i );
+			s = chars_ + offsets_[id];
+			len = (size_t)( offsets_[id+1] - offsets_[id] );
+		}
+
+		unsigned long long id_of( unsigned long long i ) const // index of the distinct string
+		{
+			return __bit_get( words_, (unsigned int)width_, i );
+		}
+
+		unsigned long long distinct() const { return count_; }
+
+	private:
+		unsigned long long count_, width_;
+		const unsigned long long* offsets_;
+		const char_type* chars_;
+		const unsigned long long* words_;
+	};
+};
+
+} // namespace tst
+
+#endif // TST_COLUMN_H
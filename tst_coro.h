@@ -0,0 +1,226 @@
+/*
+author: suninf
+description: coroutine lookups over tst_map. A query prefetches the next node
+			 and suspends before touching it; tst_scheduler resumes the queries
+			 round robin, so one thread keeps the cache misses of many
+			 in-flight lookups overlapping instead of waiting on each in turn.
+
+			 tst::tst_scheduler s;
+			 auto q = tst::async_find( s, m, key ); // scheduled at once
+			 s.run();                               // q and m must outlive it
+			 q.result();
+
+			 find_interleaved( m, beg, end, out ) does that for a range of keys.
+			 Needs C++20 coroutines.
+*/
+
+#ifndef TST_CORO_H
+#define TST_CORO_H
+
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <utility>
+#include <vector>
+#include "tst_map.h"
+
+namespace tst {
+
+inline void __tst_prefetch( const void* p )
+{
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_prefetch( p );
+#else
+	(void)p;
+#endif
+}
+
+// resumes suspended queries in the order they suspended
+class tst_scheduler
+{
+public:
+	struct hop_awaiter // prefetch p, let the others run, then go on
+	{
+		tst_scheduler* s;
+		const void* p;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend( std::coroutine_handle<> h )
+		{
+			__tst_prefetch( p );
+			s->schedule( h );
+		}
+		void await_resume() const noexcept {}
+	};
+
+	hop_awaiter hop( const void* p ) { return hop_awaiter{ this, p }; }
+
+	void schedule( std::coroutine_handle<> h ) { ready_.push_back( h ); }
+
+	void run() // until every query has finished
+	{
+		while ( !ready_.empty() )
+		{
+			std::coroutine_handle<> h = ready_.front();
+			ready_.pop_front();
+			h.resume();
+		}
+	}
+
+	size_t pending() const { return ready_.size(); }
+
+private:
+	std::deque< std::coroutine_handle<> > ready_;
+};
+
+// the handle of a query coroutine; the first parameter of such a coroutine
+// is the scheduler it runs on
+template<typename R>
+class tst_query
+{
+public:
+	struct promise_type
+	{
+		template<typename... Args>
+		promise_type( tst_scheduler& s, Args&&... ) : sched_(&s), value_() {}
+
+		tst_query get_return_object()
+		{
+			return tst_query( std::coroutine_handle<promise_type>::from_promise(*this) );
+		}
+
+		struct __start
+		{
+			tst_scheduler* s;
+			bool await_ready() const noexcept { return false; }
+			void await_suspend( std::coroutine_handle<> h ) { s->schedule( h ); }
+			void await_resume() const noexcept {}
+		};
+
+		__start initial_suspend() { return __start{ sched_ }; }
+		std::suspend_always final_suspend() noexcept { return {}; } // keeps the result
+		void return_value( R v ) { value_ = v; }
+		void unhandled_exception() { error_ = std::current_exception(); }
+
+		tst_scheduler* sched_;
+		R value_;
+		std::exception_ptr error_;
+	};
+
+	typedef std::coroutine_handle<promise_type> handle_type;
+
+	tst_query( tst_query&& q ) noexcept : h_(q.h_) { q.h_ = 0; }
+
+	tst_query& operator = ( tst_query&& q ) noexcept
+	{
+		std::swap( h_, q.h_ );
+		return *this;
+	}
+
+	~tst_query()
+	{
+		if ( h_ )
+			h_.destroy();
+	}
+
+	bool done() const { return h_.done(); }
+
+	R result() const // after done(); rethrows what the query threw
+	{
+		if ( h_.promise().error_ )
+			std::rethrow_exception( h_.promise().error_ );
+		return h_.promise().value_;
+	}
+
+private:
+	explicit tst_query( handle_type h ) : h_(h) {}
+
+	tst_query( const tst_query& ) = delete;
+	tst_query& operator = ( const tst_query& ) = delete;
+
+private:
+	handle_type h_;
+};
+
+// tst_map::find, one suspension per node; str is copied into the query
+template<typename Map>
+tst_query<typename Map::const_pointer>
+async_find( tst_scheduler& s, const Map& m, typename Map::tstring str )
+{
+	typename Map::key_compare comp;
+	typename Map::node_ptr p = m.root();
+	const typename Map::tstring::value_type* k = str.c_str();
+	if ( str.empty() )
+		co_return 0;
+	while ( p )
+	{
+		co_await s.hop( p );
+		if ( comp( *k, p->splitchar ) )
+			p = p->lokid;
+		else if ( comp( p->splitchar, *k ) )
+			p = p->hikid;
+		else
+		{
+			if ( *(++k) == 0 )
+				co_return p->pdata;
+			p = p->eqkid;
+		}
+	}
+	co_return 0;
+}
+
+// whether some key starts with prefix
+template<typename Map>
+tst_query<bool>
+async_has_prefix( tst_scheduler& s, const Map& m, typename Map::tstring prefix )
+{
+	typename Map::key_compare comp;
+	typename Map::node_ptr p = m.root();
+	const typename Map::tstring::value_type* k = prefix.c_str();
+	if ( prefix.empty() )
+		co_return p != 0;
+	while ( p )
+	{
+		co_await s.hop( p );
+		if ( comp( *k, p->splitchar ) )
+			p = p->lokid;
+		else if ( comp( p->splitchar, *k ) )
+			p = p->hikid;
+		else
+		{
+			if ( *(++k) == 0 )
+				co_return p->pdata != 0 || p->eqkid != 0;
+			p = p->eqkid;
+		}
+	}
+	co_return false;
+}
+
+// *out++ = m.find( key ) for each key of [beg, end), inflight lookups at a time
+template<typename Map, typename Iter, typename OutIter>
+OutIter find_interleaved( const Map& m, Iter beg, Iter end, OutIter out, size_t inflight = 64 )
+{
+	typedef tst_query<typename Map::const_pointer> query;
+	tst_scheduler s;
+	std::vector<query> batch;
+	batch.reserve( inflight ? inflight : 1 );
+	while ( beg != end )
+	{
+		batch.clear();
+		for ( ; beg != end && batch.size() < ( inflight ? inflight : 1 ); ++beg )
+		{
+			batch.push_back( async_find( s, m, *beg ) );
+		}
+		s.run();
+		for ( size_t i = 0; i < batch.size(); ++i )
+		{
+			*out++ = batch[i].result();
+		}
+	}
+	return out;
+}
+
+} // namespace tst
+
+#endif // TST_CORO_H
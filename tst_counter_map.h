@@ -0,0 +1,215 @@
+/*
+author: suninf
+description: tst_counter_map counts keys from many threads at once, e.g. token
+			 frequencies. Each node holds an atomic count, and nodes are only
+			 ever added: a thread that finds a null link allocates the node and
+			 publishes it with one compare-and-swap, and the loser of a race
+			 frees its copy and goes on through the winner's. So increment
+			 takes no lock, and counts of different keys never contend.
+
+			 a key is present once its count is not 0. count, foreach and
+			 snapshot may run during increments and see each count at some
+			 point of time; clear and destruction need the map to be quiet.
+
+			 Needs C++11 atomics.
+*/
+
+#ifndef TST_COUNTER_MAP_H
+#define TST_COUNTER_MAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+
+namespace tst {
+
+template< typename Ch, typename Counter >
+struct counter_tnode
+{
+	typedef counter_tnode* node_ptr;
+	explicit counter_tnode( Ch ch ) :
+	splitchar(ch), lokid(nullptr), hikid(nullptr), eqkid(nullptr), count(0) {}
+
+	Ch splitchar;
+	std::atomic<node_ptr> lokid, hikid, eqkid;
+	std::atomic<Counter> count;
+};
+
+template<typename Ch = char, typename Comp = std::less<Ch>, typename Counter = unsigned long long>
+class tst_counter_map
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef counter_tnode<Ch, Counter> node_type;
+	typedef node_type* node_ptr;
+	typedef tstring key_type;
+	typedef Comp key_compare;
+	typedef Counter value_type;
+
+public:
+	tst_counter_map() : root_(nullptr), size_(0) {}
+
+	~tst_counter_map()
+	{
+		clear();
+	}
+
+	tst_counter_map( const tst_counter_map& ) = delete;
+	tst_counter_map& operator = ( const tst_counter_map& ) = delete;
+
+	// adds delta to the count of key [s, s+n), returns the new count; thread-safe
+	Counter increment( const Ch* s, size_t n, Counter delta )
+	{
+		if ( n == 0 ) // ignore empty string
+			return 0;
+		node_ptr p = __make_path( s, n );
+		Counter old = p->count.fetch_add( delta, std::memory_order_relaxed );
+		Counter now = old + delta;
+		if ( old == 0 && now != 0 ) // each transition is seen by one thread only
+			size_.fetch_add( 1, std::memory_order_relaxed );
+		else if ( old != 0 && now == 0 )
+			size_.fetch_sub( 1, std::memory_order_relaxed );
+		return now;
+	}
+
+	Counter increment( const tstring& key, Counter delta = 1 )
+	{
+		return increment( key.data(), key.size(), delta );
+	}
+
+	Counter count( const Ch* s, size_t n ) const // 0 if absent
+	{
+		node_ptr p = __find_node( s, n );
+		return p ? p->count.load( std::memory_order_relaxed ) : 0;
+	}
+
+	Counter count( const tstring& key ) const
+	{
+		return count( key.data(), key.size() );
+	}
+
+	template<typename Func>
+	void foreach( Func f ) const // f( const tstring&, Counter ) in key order, counts not 0
+	{
+		tstring str;
+		__travel( root_.load( std::memory_order_acquire ), str, f );
+	}
+
+	template< typename Seq > // for vector,deque,list, value_type: pair<string, Counter>
+	void sequence( Seq& c ) const
+	{
+		c.clear();
+		foreach( [&c]( const tstring& key, Counter n ) { c.push_back( std::make_pair( key, n ) ); } );
+	}
+
+	template<typename Map>
+	void snapshot( Map& m ) const // into a tst_map<Counter, Ch, ...>, m is cleared first
+	{
+		m.clear();
+		foreach( [&m]( const tstring& key, Counter n ) { m.insert( key, n ); } );
+	}
+
+	// keys with a count not 0; during increments a key's two transitions may
+	// land in either order, so the sum is clamped at 0
+	size_t size() const
+	{
+		std::ptrdiff_t n = size_.load( std::memory_order_relaxed );
+		return n > 0 ? (size_t)n : 0;
+	}
+
+	bool empty() const { return size() == 0; }
+
+	void clear() // not thread-safe
+	{
+		__destroy( root_.exchange( nullptr ) );
+		size_ = 0;
+	}
+
+private: // inner use for implement
+	node_ptr __make_path( const Ch* s, size_t n ) // the node of the last character
+	{
+		const Ch* e = s + n;
+		std::atomic<node_ptr>* link = &root_;
+		while ( true )
+		{
+			node_ptr p = link->load( std::memory_order_acquire );
+			if ( p == nullptr )
+			{
+				node_ptr q = new node_type( *s );
+				if ( link->compare_exchange_strong( p, q, std::memory_order_acq_rel,
+					std::memory_order_acquire ) )
+					p = q;
+				else
+					delete q; // another thread linked its node first, p is that one
+			}
+			if ( comp_( *s, p->splitchar ) )
+				link = &p->lokid;
+			else if ( comp_( p->splitchar, *s ) )
+				link = &p->hikid;
+			else
+			{
+				if ( ++s == e )
+					return p;
+				link = &p->eqkid;
+			}
+		}
+	}
+
+	node_ptr __find_node( const Ch* s, size_t n ) const
+	{
+		const Ch* e = s + n;
+		if ( n == 0 )
+			return nullptr;
+		node_ptr p = root_.load( std::memory_order_acquire );
+		while ( p )
+		{
+			if ( comp_( *s, p->splitchar ) )
+				p = p->lokid.load( std::memory_order_acquire );
+			else if ( comp_( p->splitchar, *s ) )
+				p = p->hikid.load( std::memory_order_acquire );
+			else
+			{
+				if ( ++s == e )
+					return p;
+				p = p->eqkid.load( std::memory_order_acquire );
+			}
+		}
+		return nullptr;
+	}
+
+	template< typename Func >
+	void __travel( node_ptr p, tstring& cur_str, Func& f ) const
+	{
+		if ( !p )
+			return;
+		__travel( p->lokid.load( std::memory_order_acquire ), cur_str, f );
+		cur_str.push_back( p->splitchar );
+		Counter n = p->count.load( std::memory_order_relaxed );
+		if ( n != 0 )
+			f( (const tstring&)cur_str, n );
+		__travel( p->eqkid.load( std::memory_order_acquire ), cur_str, f );
+		cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		__travel( p->hikid.load( std::memory_order_acquire ), cur_str, f );
+	}
+
+	static void __destroy( node_ptr p )
+	{
+		if ( p == nullptr )
+			return;
+		__destroy( p->lokid.load( std::memory_order_relaxed ) );
+		__destroy( p->eqkid.load( std::memory_order_relaxed ) );
+		__destroy( p->hikid.load( std::memory_order_relaxed ) );
+		delete p;
+	}
+
+private:
+	Comp comp_;
+	std::atomic<node_ptr> root_;
+	std::atomic<std::ptrdiff_t> size_; // may dip below 0 for a moment
+};
+
+} // namespace tst
+
+#endif // TST_COUNTER_MAP_H
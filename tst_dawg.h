@@ -0,0 +1,457 @@
+/*
+author: suninf
+description: tst_dawg is a frozen ternary search tree whose equal subtrees
+			 are stored once, a directed acyclic word graph: the shared
+			 suffixes of a word list (-ing, -tion, ...) take one copy.
+			 Every node counts the keys below it, which ranks the keys
+			 0..size()-1 in order: index_of( key ) is a minimal perfect hash
+			 into an array of values, and key_at( rank ) goes back.
+
+			 tst::tst_dawg<> d;
+			 std::vector<int> values;
+			 tst::minimize( m, d, values ); // values[ d.index_of( key ) ]
+
+			 Built from keys in sorted order one level at a time, as the
+			 flat writer does; each level is a balanced BST, so equal key
+			 sets always give equal subtrees, and a level is merged with an
+			 existing equal one as soon as it is complete.
+*/
+
+#ifndef TST_DAWG_H
+#define TST_DAWG_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "tst_map.h"
+#include "tst_algorithm.h" // tst_walker
+
+namespace tst {
+
+template<typename Ch, typename Index>
+struct dawg_node
+{
+	Index lokid, hikid, eqkid;
+	Index count; // keys in this node's subtree, lokid and hikid included
+	Ch splitchar;
+	bool final;  // a key ends here
+};
+
+template<typename Ch = char, typename Comp = std::less<Ch>, typename Index = unsigned int>
+class tst_dawg
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef dawg_node<Ch, Index> node_type;
+	typedef tstring key_type;
+	typedef Comp key_compare;
+	typedef Index index_type;
+
+	static const Index npos = (Index)-1;
+
+public:
+	tst_dawg() : root_(0)
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		nodes_.assign( 1, node_type() ); // node 0 links nothing
+		nodes_[0].lokid = nodes_[0].hikid = nodes_[0].eqkid = nodes_[0].count = 0;
+		nodes_[0].splitchar = Ch();
+		nodes_[0].final = false;
+		register_.clear();
+		levels_.clear();
+		prev_.clear();
+		root_ = 0;
+	}
+
+	// building: keys in strictly increasing order by Comp, then finish()
+	bool add( const tstring& key )
+	{
+		if ( key.empty() )
+			return false;
+		size_t c = 0;
+		if ( !prev_.empty() )
+		{
+			while ( c < prev_.size() && c < key.size()
+				&& !comp_( prev_[c], key[c] ) && !comp_( key[c], prev_[c] ) )
+				++c;
+			if ( c == key.size() || ( c < prev_.size() && comp_( key[c], prev_[c] ) ) )
+				return false;
+		}
+		while ( levels_.size() > c + 1 )
+			__close_level();
+		for ( size_t d = c; d < key.size(); ++d )
+		{
+			__entry e = { key[d], false, 0 };
+			if ( d < levels_.size() )
+				levels_[d].push_back( e );
+			else
+				levels_.push_back( std::vector<__entry>( 1, e ) );
+		}
+		levels_.back().back().final = true;
+		prev_ = key;
+		return true;
+	}
+
+	void finish()
+	{
+		while ( !levels_.empty() )
+			__close_level();
+		register_.clear(); // only needed while building
+		prev_.clear();
+	}
+
+	// rank of key among the keys, npos if absent
+	Index index_of( const tstring& str ) const
+	{
+		return index_of( str.data(), str.size() );
+	}
+
+	Index index_of( const Ch* s, size_t n ) const
+	{
+		Index i = root_;
+		Index rank = 0;
+		const Ch* e = s + n;
+		if ( n == 0 )
+			return npos;
+		while ( i )
+		{
+			const node_type& p = nodes_[i];
+			if ( comp_( *s, p.splitchar ) )
+				i = p.lokid;
+			else if ( comp_( p.splitchar, *s ) )
+			{
+				rank += p.count - nodes_[p.hikid].count;
+				i = p.hikid;
+			}
+			else
+			{
+				rank += nodes_[p.lokid].count;
+				if ( ++s == e )
+					return p.final ? rank : npos;
+				rank += p.final ? 1 : 0;
+				i = p.eqkid;
+			}
+		}
+		return npos;
+	}
+
+	bool contains( const tstring& str ) const { return index_of( str ) != npos; }
+
+	tstring key_at( Index rank ) const // the key of index_of rank, empty if out of range
+	{
+		tstring str;
+		Index i = root_;
+		if ( rank >= size() )
+			return str;
+		while ( i )
+		{
+			const node_type& p = nodes_[i];
+			Index lo = nodes_[p.lokid].count;
+			Index here = lo + ( p.final ? 1 : 0 ) + nodes_[p.eqkid].count;
+			if ( rank < lo )
+				i = p.lokid;
+			else if ( rank >= here )
+			{
+				rank -= here;
+				i = p.hikid;
+			}
+			else
+			{
+				str.push_back( p.splitchar );
+				rank -= lo;
+				if ( p.final )
+				{
+					if ( rank == 0 )
+						return str;
+					--rank;
+				}
+				i = p.eqkid;
+			}
+		}
+		return str;
+	}
+
+	bool has_prefix( const tstring& prefix ) const
+	{
+		if ( prefix.empty() )
+			return size() > 0;
+		Index i = __descend( prefix );
+		return i && ( nodes_[i].final || nodes_[i].eqkid );
+	}
+
+	// pair( key, rank ) of every key starting with prefix, in key order
+	template< typename Seq >
+	void prefix_search( const tstring& prefix, Seq& c ) const
+	{
+		c.clear();
+		__push_back<Seq> f(c);
+		tstring str( prefix );
+		if ( prefix.empty() )
+		{
+			__walk( root_, 0, str, f );
+			return;
+		}
+		Index i = __descend( prefix );
+		if ( !i )
+			return;
+		Index rank = __rank_below( prefix );
+		if ( nodes_[i].final )
+			c.push_back( std::make_pair( str, rank++ ) );
+		__walk( nodes_[i].eqkid, rank, str, f );
+	}
+
+	template< typename Seq >
+	void pmsearch( const tstring& str, Seq& c ) const // '.' matches any character
+	{
+		tstring strtmp;
+		c.clear();
+		__pmsearch( root_, 0, str.c_str(), strtmp, c );
+	}
+
+	template<typename Func>
+	void foreach( Func f ) const // f( const tstring&, Index rank ) in key order
+	{
+		tstring str;
+		__walk( root_, 0, str, f );
+	}
+
+	size_t size() const { return nodes_[root_].count; }
+
+	bool empty() const { return size() == 0; }
+
+	size_t node_count() const { return nodes_.size() - 1; }
+
+	// low-level access
+	Index root() const { return root_; }
+
+	const node_type& node( Index i ) const { return nodes_[i]; }
+
+private: // inner use for implement
+	struct __entry
+	{
+		Ch ch;
+		bool final;
+		Index eq;
+	};
+
+	struct __shape // what makes two nodes equal
+	{
+		Ch ch;
+		bool final;
+		Index lo, eq, hi;
+
+		bool operator < ( const __shape& o ) const
+		{
+			Comp comp;
+			if ( comp( ch, o.ch ) || comp( o.ch, ch ) )
+				return comp( ch, o.ch );
+			if ( final != o.final )
+				return final < o.final;
+			if ( lo != o.lo )
+				return lo < o.lo;
+			if ( eq != o.eq )
+				return eq < o.eq;
+			return hi < o.hi;
+		}
+	};
+
+	void __close_level()
+	{
+		std::vector<__entry> e;
+		e.swap( levels_.back() );
+		levels_.pop_back();
+		Index top = __link( e, 0, e.size() );
+		if ( levels_.empty() )
+			root_ = top;
+		else
+			levels_.back().back().eq = top;
+	}
+
+	Index __link( const std::vector<__entry>& e, size_t a, size_t b ) // balanced, children first
+	{
+		if ( a >= b )
+			return 0;
+		size_t mid = a + ( b - a ) / 2;
+		__shape s;
+		s.ch = e[mid].ch;
+		s.final = e[mid].final;
+		s.lo = __link( e, a, mid );
+		s.hi = __link( e, mid + 1, b );
+		s.eq = e[mid].eq;
+		return __intern( s );
+	}
+
+	Index __intern( const __shape& s )
+	{
+		typename std::map<__shape, Index>::iterator it = register_.find( s );
+		if ( it != register_.end() )
+			return it->second;
+		node_type n;
+		n.lokid = s.lo;
+		n.hikid = s.hi;
+		n.eqkid = s.eq;
+		n.splitchar = s.ch;
+		n.final = s.final;
+		n.count = nodes_[s.lo].count + nodes_[s.hi].count + nodes_[s.eq].count + ( s.final ? 1 : 0 );
+		nodes_.push_back( n );
+		Index i = (Index)( nodes_.size() - 1 );
+		register_.insert( std::make_pair( s, i ) );
+		return i;
+	}
+
+	Index __descend( const tstring& str ) const // node of the last character, 0 if none
+	{
+		Index i = root_;
+		const Ch* s = str.data();
+		const Ch* e = s + str.size();
+		while ( i )
+		{
+			const node_type& p = nodes_[i];
+			if ( comp_( *s, p.splitchar ) )
+				i = p.lokid;
+			else if ( comp_( p.splitchar, *s ) )
+				i = p.hikid;
+			else
+			{
+				if ( ++s == e )
+					return i;
+				i = p.eqkid;
+			}
+		}
+		return 0;
+	}
+
+	Index __rank_below( const tstring& prefix ) const // keys less than prefix
+	{
+		Index i = root_;
+		Index rank = 0;
+		const Ch* s = prefix.data();
+		const Ch* e = s + prefix.size();
+		while ( i )
+		{
+			const node_type& p = nodes_[i];
+			if ( comp_( *s, p.splitchar ) )
+				i = p.lokid;
+			else if ( comp_( p.splitchar, *s ) )
+			{
+				rank += p.count - nodes_[p.hikid].count;
+				i = p.hikid;
+			}
+			else
+			{
+				rank += nodes_[p.lokid].count;
+				if ( ++s == e )
+					return rank;
+				rank += p.final ? 1 : 0;
+				i = p.eqkid;
+			}
+		}
+		return rank;
+	}
+
+	// visits the subtree at i, whose first key has rank `rank`
+	template< typename Func >
+	void __walk( Index i, Index rank, tstring& cur_str, Func& f ) const
+	{
+		if ( !i )
+			return;
+		const node_type& p = nodes_[i];
+		__walk( p.lokid, rank, cur_str, f );
+		rank += nodes_[p.lokid].count;
+		cur_str.push_back( p.splitchar );
+		if ( p.final )
+			f( (const tstring&)cur_str, rank++ );
+		__walk( p.eqkid, rank, cur_str, f );
+		rank += nodes_[p.eqkid].count;
+		cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		__walk( p.hikid, rank, cur_str, f );
+	}
+
+	template< typename Seq >
+	void __pmsearch( Index i, Index rank, const Ch* s, tstring& cur_str, Seq& c ) const
+	{
+		if ( *s == 0 || !i )
+			return;
+		const node_type& p = nodes_[i];
+		if ( *s=='.' || comp_(*s, p.splitchar) )
+		{
+			__pmsearch( p.lokid, rank, s, cur_str, c );
+		}
+		Index here = rank + nodes_[p.lokid].count;
+		if ( *s=='.' || ( !comp_(*s, p.splitchar) && !comp_( p.splitchar, *s ) ) )
+		{
+			cur_str.push_back( p.splitchar );
+			if ( *(s+1) == 0 && p.final )
+			{
+				c.push_back( std::make_pair( cur_str, here ) );
+			}
+			else if ( *(s+1) )
+			{
+				__pmsearch( p.eqkid, here + ( p.final ? 1 : 0 ), s+1, cur_str, c );
+			}
+			cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		}
+		if ( *s=='.' || comp_( p.splitchar, *s ) )
+		{
+			__pmsearch( p.hikid, rank + p.count - nodes_[p.hikid].count, s, cur_str, c );
+		}
+	}
+
+	template< typename Seq >
+	struct __push_back
+	{
+		Seq& c_;
+		__push_back( Seq& c ) : c_(c) {}
+		void operator()( const tstring& str, Index rank )
+		{
+			c_.push_back( std::make_pair( str, rank ) );
+		}
+	};
+
+private:
+	std::vector<node_type> nodes_;
+	Index root_;
+	std::map<__shape, Index> register_; // built nodes by shape, while building
+	std::vector< std::vector<__entry> > levels_;
+	tstring prev_;
+	Comp comp_;
+};
+
+template<typename Ch, typename Comp, typename Index>
+const Index tst_dawg<Ch, Comp, Index>::npos;
+
+// the keys of m into d; values[ d.index_of( key ) ] is m's value of key
+template<typename T, typename Ch, typename Comp, typename Index, typename Seq>
+void minimize( const tst_map<T, Ch, Comp>& m, tst_dawg<Ch, Comp, Index>& d, Seq& values )
+{
+	tst_walker< tst_map<T, Ch, Comp> > it( m );
+	d.clear();
+	values.clear();
+	while ( it.next() )
+	{
+		d.add( it.key() );
+		values.push_back( *it.value() );
+	}
+	d.finish();
+}
+
+template<typename T, typename Ch, typename Comp, typename Index>
+void minimize( const tst_map<T, Ch, Comp>& m, tst_dawg<Ch, Comp, Index>& d ) // keys only
+{
+	tst_walker< tst_map<T, Ch, Comp> > it( m );
+	d.clear();
+	while ( it.next() )
+	{
+		d.add( it.key() );
+	}
+	d.finish();
+}
+
+} // namespace tst
+
+#endif // TST_DAWG_H
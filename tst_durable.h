@@ -0,0 +1,505 @@
+/*
+author: suninf
+description: tst_durable_map makes a tst_map crash-recoverable. Every insert and
+			 remove is appended to a binary write-ahead log; records are
+			 group-committed, one write and one fsync per batch. checkpoint()
+			 writes a snapshot of the whole tree and starts a new log, and
+			 open() recovers by loading the snapshot and replaying the log tail.
+
+			 files: <path>.snap, <path>.log
+			 log record: u32 length, u32 checksum, then length bytes of
+						 u8 op, key, value (insert only)
+			 a torn or corrupt record ends the log; everything after it is
+			 dropped on recovery.
+
+			 a group that fails to write is cut back off the log and stays
+			 pending, and the insert or remove that set it off fails; a
+			 failed checkpoint goes on with the old snapshot and log. If the
+			 log cannot be reopened the map is closed and failed() is true.
+*/
+
+#ifndef TST_DURABLE_H
+#define TST_DURABLE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "tst_map.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace tst {
+
+// value codecs: put appends v to buf, get reads it back from [p, end)
+template<typename T>
+struct pod_codec // trivially copyable T, native byte order
+{
+	static void put( std::string& buf, const T& v )
+	{
+		buf.append( (const char*)&v, sizeof(T) );
+	}
+
+	static bool get( const char*& p, const char* end, T& v )
+	{
+		if ( end - p < (ptrdiff_t)sizeof(T) )
+			return false;
+		std::memcpy( &v, p, sizeof(T) );
+		p += sizeof(T);
+		return true;
+	}
+};
+
+template<typename Str>
+struct string_codec // basic_string values, u32 length then the characters
+{
+	typedef typename Str::value_type char_type;
+
+	static void put( std::string& buf, const Str& v )
+	{
+		pod_codec<unsigned int>::put( buf, (unsigned int)v.size() );
+		buf.append( (const char*)v.data(), v.size() * sizeof(char_type) );
+	}
+
+	static bool get( const char*& p, const char* end, Str& v )
+	{
+		unsigned int n = 0;
+		if ( !pod_codec<unsigned int>::get( p, end, n ) )
+			return false;
+		if ( (size_t)(end - p) / sizeof(char_type) < n )
+			return false;
+		v.resize( n );
+		if ( n )
+			std::memcpy( &v[0], p, n * sizeof(char_type) );
+		p += n * sizeof(char_type);
+		return true;
+	}
+};
+
+template<typename T, typename Ch = char, typename Comp = std::less<Ch>,
+	typename Codec = pod_codec<T> >
+class tst_durable_map
+{
+public:
+	typedef tst_map<T, Ch, Comp> map_type;
+	typedef typename map_type::tstring tstring;
+	typedef tstring key_type;
+
+	typedef T value_type;
+	typedef T const& const_reference;
+	typedef T const* const_pointer;
+
+public:
+	tst_durable_map()
+		: log_(0), group_ops_(1024), group_bytes_(1 << 20), pending_ops_(0),
+		log_bytes_(0), checkpoint_bytes_(0), failed_(false), checkpoint_failed_(false) {}
+
+	~tst_durable_map()
+	{
+		close();
+	}
+
+	// recover the map stored at path, or start an empty one
+	bool open( const std::string& path )
+	{
+		close();
+		map_.clear();
+		pending_.clear();
+		pending_ops_ = 0;
+		failed_ = false;
+		checkpoint_failed_ = false;
+		path_ = path;
+
+		if ( !__load_snapshot() )
+			return false;
+		bool clean = true;
+		if ( !__replay_log( clean ) )
+			return false;
+		if ( !clean ) // drop the torn tail for good
+			return checkpoint();
+
+		log_ = std::fopen( (path_ + ".log").c_str(), "ab" );
+		return log_ != 0;
+	}
+
+	bool close() // commits what is pending
+	{
+		bool ok = !failed_;
+		if ( log_ )
+		{
+			ok = commit() && ok;
+			std::fclose( log_ );
+			log_ = 0;
+		}
+		return ok;
+	}
+
+	bool is_open() const { return log_ != 0; }
+
+	bool failed() const { return failed_; } // the log was lost, writes are refused
+
+	// applied to the map at once, durable after the next commit
+	const_pointer insert( const tstring& str, const T& val )
+	{
+		if ( !log_ || str.empty() )
+			return 0;
+		std::string rec;
+		rec.push_back( (char)__op_insert );
+		__put_key( rec, str );
+		Codec::put( rec, val );
+		if ( !__append( rec ) )
+			return 0;
+		return map_.insert( str, val );
+	}
+
+	bool remove( const tstring& str )
+	{
+		if ( !log_ || !map_.find( str ) )
+			return false;
+		std::string rec;
+		rec.push_back( (char)__op_remove );
+		__put_key( rec, str );
+		if ( !__append( rec ) )
+			return false;
+		return map_.remove( str );
+	}
+
+	bool erase( const tstring& str ) { return remove(str); }
+
+	// write and fsync the pending records as one group; false also if an
+	// automatic checkpoint failed since the last commit
+	bool commit()
+	{
+		bool ok = !checkpoint_failed_;
+		checkpoint_failed_ = false;
+		if ( !log_ )
+			return false;
+		if ( pending_.empty() )
+			return ok;
+		if ( !__write_group() )
+			return false;
+		if ( checkpoint_bytes_ && log_bytes_ >= checkpoint_bytes_ )
+			ok = checkpoint() && ok;
+		return ok;
+	}
+
+	// a group is committed once it holds ops records or bytes bytes
+	void group_commit( size_t ops, size_t bytes )
+	{
+		group_ops_ = ops;
+		group_bytes_ = bytes;
+	}
+
+	// checkpoint automatically once the log grows past bytes, 0 never
+	void checkpoint_every( size_t bytes ) { checkpoint_bytes_ = bytes; }
+
+	// snapshot the tree, then start an empty log; on failure the map goes on
+	// with the old snapshot and log
+	bool checkpoint()
+	{
+		bool was_open = log_ != 0;
+		if ( log_ )
+		{
+			if ( !pending_.empty() && !__write_group() )
+				return false;
+			std::fclose( log_ );
+			log_ = 0;
+		}
+
+		bool ok = __write_snapshot();
+		if ( ok )
+		{
+			log_ = std::fopen( (path_ + ".log").c_str(), "wb" );
+			if ( log_ )
+				log_bytes_ = 0;
+			ok = log_ != 0 && __sync( log_ );
+		}
+		if ( !log_ && was_open )
+		{// the old log still replays correctly over either snapshot
+			log_ = std::fopen( (path_ + ".log").c_str(), "ab" );
+			failed_ = log_ == 0;
+		}
+		return ok;
+	}
+
+	const_pointer find( const tstring& str ) const { return map_.find( str ); }
+
+	const T operator[]( const tstring& str ) const { return map_[str]; }
+
+	size_t size() const { return map_.size(); }
+
+	bool empty() const { return map_.empty(); }
+
+	const map_type& map() const { return map_; }
+
+private: // inner use for implement
+	enum { __op_insert = 1, __op_remove = 2 };
+
+	static const char* const __snap_magic;
+
+	static unsigned int __checksum( const char* p, size_t n ) // FNV-1a
+	{
+		unsigned int h = 2166136261u;
+		for ( size_t i = 0; i < n; ++i )
+		{
+			h = ( h ^ (unsigned char)p[i] ) * 16777619u;
+		}
+		return h;
+	}
+
+	static bool __sync( std::FILE* f )
+	{
+		if ( std::fflush( f ) != 0 )
+			return false;
+#ifdef _WIN32
+		return _commit( _fileno(f) ) == 0;
+#else
+		return fsync( fileno(f) ) == 0;
+#endif
+	}
+
+	bool __sync_dir() const // make the rename of the snapshot durable
+	{
+#ifdef _WIN32
+		return true;
+#else
+		std::string::size_type slash = path_.rfind( '/' );
+		std::string dir = slash == std::string::npos ? "." : path_.substr( 0, slash + 1 );
+		int fd = ::open( dir.c_str(), O_RDONLY );
+		if ( fd < 0 )
+			return false;
+		bool ok = fsync( fd ) == 0;
+		::close( fd );
+		return ok;
+#endif
+	}
+
+	static void __put_key( std::string& buf, const tstring& str )
+	{
+		string_codec<tstring>::put( buf, str );
+	}
+
+	// queue rec, writing the group once it is full; false if that write
+	// failed, rec is dropped then and the rest of the group stays pending
+	bool __append( const std::string& rec )
+	{
+		size_t mark = pending_.size();
+		pod_codec<unsigned int>::put( pending_, (unsigned int)rec.size() );
+		pod_codec<unsigned int>::put( pending_, __checksum( rec.data(), rec.size() ) );
+		pending_ += rec;
+		if ( ++pending_ops_ < group_ops_ && pending_.size() < group_bytes_ )
+			return true;
+		if ( !__write_group() )
+		{
+			pending_.resize( mark );
+			--pending_ops_;
+			return false;
+		}
+		if ( checkpoint_bytes_ && log_bytes_ >= checkpoint_bytes_ && !checkpoint() )
+			checkpoint_failed_ = true; // rec is durable already, the next commit reports it
+		return true;
+	}
+
+	// write and fsync pending_; on failure the log is cut back to its last
+	// good record and pending_ is kept
+	bool __write_group()
+	{
+		bool ok = std::fwrite( pending_.data(), 1, pending_.size(), log_ ) == pending_.size()
+			&& __sync( log_ );
+		if ( !ok )
+		{
+			__rewind_log();
+			return false;
+		}
+		log_bytes_ += pending_.size();
+		pending_.clear();
+		pending_ops_ = 0;
+		return true;
+	}
+
+	void __rewind_log() // truncate to log_bytes_ and reopen, else the map is failed
+	{
+		std::fclose( log_ );
+		log_ = 0;
+		std::string name = path_ + ".log";
+#ifdef _WIN32
+		int fd = _open( name.c_str(), _O_WRONLY | _O_BINARY );
+		bool ok = fd >= 0 && _chsize_s( fd, (__int64)log_bytes_ ) == 0;
+		if ( fd >= 0 )
+			_close( fd );
+#else
+		bool ok = truncate( name.c_str(), (off_t)log_bytes_ ) == 0;
+#endif
+		if ( ok )
+			log_ = std::fopen( name.c_str(), "ab" );
+		failed_ = log_ == 0;
+	}
+
+	bool __write_snapshot() // <path>.snap replaced in whole
+	{
+		std::string tmp = path_ + ".snap.tmp";
+		std::FILE* f = std::fopen( tmp.c_str(), "wb" );
+		if ( !f )
+			return false;
+		__snapshot_buffer b( f );
+		std::fwrite( __snap_magic, 1, 8, f );
+		pod_codec<unsigned long long>::put( b.buf_, (unsigned long long)map_.size() );
+		map_.foreach( __snapshot_writer(b) );
+		bool ok = b.flush() && __sync( f );
+		ok = ( std::fclose( f ) == 0 ) && ok;
+		if ( !ok )
+			return false;
+
+		// replaying an old log over the new snapshot is harmless, the last
+		// record of every key wins either way
+		std::string snap = path_ + ".snap";
+#ifdef _WIN32
+		std::remove( snap.c_str() ); // rename does not replace there
+#endif
+		return std::rename( tmp.c_str(), snap.c_str() ) == 0 && __sync_dir();
+	}
+
+	static bool __read_file( const std::string& name, std::string& data, bool& exists )
+	{
+		data.clear();
+		std::FILE* f = std::fopen( name.c_str(), "rb" );
+		exists = f != 0;
+		if ( !f )
+			return true;
+		char buf[1 << 16];
+		size_t n;
+		while ( (n = std::fread( buf, 1, sizeof(buf), f )) > 0 )
+		{
+			data.append( buf, n );
+		}
+		bool ok = !std::ferror( f );
+		std::fclose( f );
+		return ok;
+	}
+
+	bool __load_snapshot()
+	{
+		std::string data;
+		bool exists = false;
+		if ( !__read_file( path_ + ".snap", data, exists ) )
+			return false;
+		if ( !exists )
+			return true;
+
+		const char* p = data.data();
+		const char* end = p + data.size();
+		unsigned long long n = 0;
+		if ( data.size() < 8 || std::memcmp( p, __snap_magic, 8 ) != 0 )
+			return false;
+		p += 8;
+		if ( !pod_codec<unsigned long long>::get( p, end, n ) )
+			return false;
+		for ( unsigned long long i = 0; i < n; ++i )
+		{
+			tstring key;
+			T val;
+			if ( !string_codec<tstring>::get( p, end, key ) || !Codec::get( p, end, val ) )
+				return false; // snapshots are renamed in whole, so this is real damage
+			map_.insert( key, val );
+		}
+		return true;
+	}
+
+	bool __replay_log( bool& clean )
+	{
+		std::string data;
+		bool exists = false;
+		if ( !__read_file( path_ + ".log", data, exists ) )
+			return false;
+
+		const char* p = data.data();
+		const char* end = p + data.size();
+		while ( p < end )
+		{
+			unsigned int len = 0, sum = 0;
+			const char* q = p;
+			if ( !pod_codec<unsigned int>::get( q, end, len )
+				|| !pod_codec<unsigned int>::get( q, end, sum )
+				|| (size_t)(end - q) < len || len == 0
+				|| __checksum( q, len ) != sum )
+				break;
+
+			const char* r = q;
+			const char* rend = q + len;
+			char op = *r++;
+			tstring key;
+			T val;
+			if ( !string_codec<tstring>::get( r, rend, key ) )
+				break;
+			if ( op == __op_insert && Codec::get( r, rend, val ) )
+				map_.insert( key, val );
+			else if ( op == __op_remove )
+				map_.remove( key );
+			else
+				break;
+			p = rend;
+		}
+		clean = ( p == end );
+		log_bytes_ = p - data.data();
+		return true;
+	}
+
+	struct __snapshot_buffer
+	{
+		std::FILE* f_;
+		std::string buf_;
+		bool ok_;
+		__snapshot_buffer( std::FILE* f ) : f_(f), ok_(true) {}
+
+		bool flush()
+		{
+			if ( !buf_.empty() && std::fwrite( buf_.data(), 1, buf_.size(), f_ ) != buf_.size() )
+				ok_ = false;
+			buf_.clear();
+			return ok_;
+		}
+	};
+
+	struct __snapshot_writer // foreach copies its functor, the buffer stays put
+	{
+		__snapshot_buffer& b_;
+		__snapshot_writer( __snapshot_buffer& b ) : b_(b) {}
+
+		void operator()( const tstring& str, const T& t )
+		{
+			string_codec<tstring>::put( b_.buf_, str );
+			Codec::put( b_.buf_, t );
+			if ( b_.buf_.size() >= (1 << 16) )
+				b_.flush();
+		}
+	};
+
+	tst_durable_map( const tst_durable_map& ); // owns the log file, not copyable
+	tst_durable_map& operator = ( const tst_durable_map& );
+
+private:
+	map_type map_;
+	std::string path_;
+	std::FILE* log_;
+	std::string pending_; // records not yet written
+	size_t group_ops_;
+	size_t group_bytes_;
+	size_t pending_ops_;
+	size_t log_bytes_; // up to the last record known written
+	size_t checkpoint_bytes_;
+	bool failed_;
+	bool checkpoint_failed_; // by __append, reported by the next commit
+};
+
+template<typename T, typename Ch, typename Comp, typename Codec>
+const char* const tst_durable_map<T, Ch, Comp, Codec>::__snap_magic = "TSTSNAP1";
+
+} // namespace tst
+
+#endif // TST_DURABLE_H
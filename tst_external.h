@@ -0,0 +1,331 @@
+/*
+author: suninf
+description: tst_external_builder writes a flat file (tst_flat.h) from more
+			 pairs than fit in memory. add() buffers pairs up to a memory
+			 budget and spills each full buffer to disk as a sorted run;
+			 finish() merges the runs k ways and streams the merged order
+			 into tst_flat_writer, so neither the pairs nor a pointer tree
+			 are ever held whole.
+
+			 runs: <path>.run<N>, removed by finish(); each record is a u32
+			 key length, the key's characters and the raw T, sorted by key,
+			 with no checksum or framing as they never outlive the build.
+			 At most fan_in runs are open at a time; more are first merged
+			 in passes, every fan_in neighbouring runs into one, so a pair is
+			 rewritten about log_fan_in( runs ) times.
+			 Of equal keys the one added last wins, as with insert.
+*/
+
+#ifndef TST_EXTERNAL_H
+#define TST_EXTERNAL_H
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "tst_flat.h"
+#include "tst_durable.h" // codecs
+
+namespace tst {
+
+// T trivially copyable; Column only encodes the values in the flat file
+template<typename T, typename Ch = char, typename Comp = std::less<Ch>,
+	typename Index = unsigned int, typename Column = raw_column<T> >
+class tst_external_builder
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef tst_flat_writer<T, Ch, Comp, Index, Column> writer_type;
+
+public:
+	// budget: bytes of pairs buffered before a run is spilled
+	explicit tst_external_builder( const std::string& path, size_t budget = 256 << 20,
+		unsigned int page_size = 0, size_t fan_in = 64 )
+		: path_(path), budget_(budget), page_size_(page_size), fan_in_(fan_in < 2 ? 2 : fan_in),
+		bytes_(0), ok_(true), next_run_(0) {}
+
+	~tst_external_builder()
+	{
+		__remove_runs();
+	}
+
+	bool add( const tstring& key, const T& val )
+	{
+		if ( !ok_ || key.empty() )
+			return false;
+		buf_.push_back( __pair( key, val ) );
+		bytes_ += sizeof(__pair) + key.size() * sizeof(Ch);
+		if ( bytes_ >= budget_ )
+			ok_ = __spill();
+		return ok_;
+	}
+
+	bool finish() // merges everything into the flat file at path
+	{
+		if ( !ok_ )
+			return false;
+		writer_type w;
+		if ( !w.open( path_, page_size_ ) )
+			return false;
+
+		if ( runs_.empty() ) // it all fit, no need to go through disk
+		{
+			__sort_unique( buf_ );
+			for ( size_t i = 0; ok_ && i < buf_.size(); ++i )
+			{
+				ok_ = w.add( buf_[i].first, buf_[i].second );
+			}
+			buf_.clear();
+			return w.finish() && ok_;
+		}
+
+		if ( !buf_.empty() && !__spill() )
+			return false;
+		while ( ok_ && runs_.size() > fan_in_ )
+			ok_ = __merge_pass();
+		ok_ = ok_ && __merge( 0, runs_.size(), w );
+		__remove_runs();
+		return w.finish() && ok_;
+	}
+
+	size_t runs() const { return runs_.size(); }
+
+private: // inner use for implement
+	typedef std::pair<tstring, T> __pair;
+
+	struct __less
+	{
+		bool operator()( const __pair& a, const __pair& b ) const
+		{
+			return __key_less( a.first, b.first );
+		}
+	};
+
+	static bool __key_less( const tstring& a, const tstring& b )
+	{
+		Comp comp;
+		return std::lexicographical_compare( a.begin(), a.end(), b.begin(), b.end(), comp );
+	}
+
+	static void __sort_unique( std::vector<__pair>& v ) // the last of equal keys stays
+	{
+		std::stable_sort( v.begin(), v.end(), __less() );
+		size_t n = 0;
+		for ( size_t i = 0; i < v.size(); ++i )
+		{
+			if ( n > 0 && !__key_less( v[n-1].first, v[i].first ) )
+				v[n-1].second = v[i].second;
+			else if ( n++ != i )
+				v[n-1] = v[i];
+		}
+		v.resize( n );
+	}
+
+	std::string __run_name( size_t i ) const
+	{
+		std::ostringstream os;
+		os << path_ << ".run" << i;
+		return os.str();
+	}
+
+	bool __spill()
+	{
+		__sort_unique( buf_ );
+		std::string name = __run_name( next_run_++ );
+		std::FILE* f = std::fopen( name.c_str(), "wb" );
+		if ( !f )
+			return false;
+		runs_.push_back( name );
+		__run_writer rw;
+		rw.f = f;
+		bool ok = true;
+		for ( size_t i = 0; ok && i < buf_.size(); ++i )
+		{
+			ok = rw.add( buf_[i].first, buf_[i].second );
+		}
+		ok = rw.flush() && ok;
+		ok = ( std::fclose( f ) == 0 ) && ok;
+		std::vector<__pair>().swap( buf_ );
+		bytes_ = 0;
+		return ok;
+	}
+
+	struct __run_writer
+	{
+		std::FILE* f;
+		std::string rec;
+
+		bool add( const tstring& key, const T& val )
+		{
+			string_codec<tstring>::put( rec, key );
+			pod_codec<T>::put( rec, val );
+			return rec.size() < (1 << 16) || flush();
+		}
+
+		bool flush()
+		{
+			bool ok = std::fwrite( rec.data(), 1, rec.size(), f ) == rec.size();
+			rec.clear();
+			return ok;
+		}
+	};
+
+	struct __run // a sorted run read back one record at a time
+	{
+		std::FILE* f;
+		__pair cur;
+		bool ok; // not failed
+
+		bool next() // false at the end or on damage
+		{
+			unsigned int n = 0;
+			if ( std::fread( &n, sizeof(n), 1, f ) != 1 )
+			{
+				ok = !std::ferror( f );
+				return false;
+			}
+			cur.first.resize( n );
+			ok = ( n == 0 || std::fread( &cur.first[0], sizeof(Ch), n, f ) == n )
+				&& std::fread( &cur.second, sizeof(T), 1, f ) == 1;
+			return ok;
+		}
+	};
+
+	struct __heap_greater // min-heap on key, equal keys by later run first
+	{
+		const std::vector<__run>* runs;
+		bool operator()( size_t a, size_t b ) const
+		{
+			const tstring& ka = (*runs)[a].cur.first;
+			const tstring& kb = (*runs)[b].cur.first;
+			if ( __key_less( kb, ka ) )
+				return true;
+			if ( __key_less( ka, kb ) )
+				return false;
+			return a < b;
+		}
+	};
+
+	// merges runs [first, last) into w, which has add( key, val )
+	template<typename Sink>
+	bool __merge( size_t first, size_t last, Sink& w )
+	{
+		std::vector<__run> rs( last - first );
+		std::vector<size_t> heap;
+		bool ok = true;
+		for ( size_t i = 0; i < rs.size(); ++i )
+		{
+			rs[i].f = std::fopen( runs_[first + i].c_str(), "rb" );
+			rs[i].ok = rs[i].f != 0;
+			if ( rs[i].f )
+				std::setvbuf( rs[i].f, 0, _IOFBF, 1 << 16 );
+			if ( rs[i].f && rs[i].next() )
+				heap.push_back( i );
+			ok = ok && rs[i].ok;
+		}
+		__heap_greater greater = { &rs };
+		std::make_heap( heap.begin(), heap.end(), greater );
+
+		tstring key;
+		T val = T();
+		bool have = false;
+		while ( ok && !heap.empty() )
+		{
+			std::pop_heap( heap.begin(), heap.end(), greater );
+			size_t i = heap.back();
+			if ( have && !__key_less( key, rs[i].cur.first ) )
+				; // an older run's copy of the key just written out, dropped
+			else
+			{
+				if ( have )
+					ok = w.add( key, val );
+				key = rs[i].cur.first; // the newest copy of a key comes first
+				val = rs[i].cur.second;
+				have = true;
+			}
+			if ( rs[i].next() )
+				std::push_heap( heap.begin(), heap.end(), greater );
+			else
+			{
+				heap.pop_back();
+				ok = ok && rs[i].ok;
+			}
+		}
+		if ( ok && have )
+			ok = w.add( key, val );
+		if ( ok && have )
+			ok = __flush( w );
+
+		for ( size_t i = 0; i < rs.size(); ++i )
+		{
+			if ( rs[i].f )
+				std::fclose( rs[i].f );
+		}
+		return ok;
+	}
+
+	// one level: every fan_in neighbouring runs into one, in place, so runs_
+	// stays oldest first and the runs of a level are of about one size
+	bool __merge_pass()
+	{
+		std::vector<std::string> merged;
+		bool ok = true;
+		size_t g = 0;
+		for ( ; ok && g < runs_.size(); g += fan_in_ )
+		{
+			size_t end = std::min( g + fan_in_, runs_.size() );
+			if ( end - g == 1 )
+			{
+				merged.push_back( runs_[g] );
+				continue;
+			}
+			std::string name = __run_name( next_run_++ );
+			__run_writer rw;
+			rw.f = std::fopen( name.c_str(), "wb" );
+			if ( !rw.f )
+				break;
+			merged.push_back( name );
+			ok = __merge( g, end, rw );
+			ok = ( std::fclose( rw.f ) == 0 ) && ok;
+			for ( size_t i = g; i < end; ++i )
+			{
+				std::remove( runs_[i].c_str() );
+			}
+		}
+		ok = ok && g >= runs_.size();
+		merged.insert( merged.end(), runs_.begin() + std::min( g, runs_.size() ), runs_.end() ); // removed by the caller on failure
+		runs_.swap( merged );
+		return ok;
+	}
+
+	static bool __flush( writer_type& ) { return true; }
+	static bool __flush( __run_writer& w ) { return w.flush(); }
+
+	void __remove_runs()
+	{
+		for ( size_t i = 0; i < runs_.size(); ++i )
+		{
+			std::remove( runs_[i].c_str() );
+		}
+		runs_.clear();
+	}
+
+	tst_external_builder( const tst_external_builder& );
+	tst_external_builder& operator = ( const tst_external_builder& );
+
+private:
+	std::string path_;
+	size_t budget_;
+	unsigned int page_size_;
+	size_t fan_in_;
+	std::vector<__pair> buf_;
+	size_t bytes_;
+	bool ok_;
+	std::vector<std::string> runs_; // oldest first
+	size_t next_run_;
+};
+
+} // namespace tst
+
+#endif // TST_EXTERNAL_H
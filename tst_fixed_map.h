@@ -0,0 +1,348 @@
+/*
+author: suninf
+description: tst_fixed_map is a ternary search tree over fixed-width binary keys
+			 (32/64-bit ids, IPv4/IPv6 addresses ...). Keys are walked as
+			 big-endian bytes, so the tree order is the numeric order; every key
+			 has the same compile-time depth and 0x00 bytes are ordinary bytes.
+*/
+
+#ifndef TST_FIXED_MAP_H
+#define TST_FIXED_MAP_H
+
+#include <cstddef>
+#include "tst_map.h"
+
+namespace tst {
+
+// N raw bytes in network order, e.g. fixed_bytes<4> for IPv4, fixed_bytes<16> for IPv6
+template<size_t N>
+struct fixed_bytes
+{
+	unsigned char data[N];
+};
+
+// byte view of a key: size bytes, byte(k, i) most significant first
+template<typename Key>
+struct fixed_key_traits // unsigned integral keys
+{
+	static const size_t size = sizeof(Key);
+
+	static unsigned char byte( const Key& k, size_t i )
+	{
+		return (unsigned char)( k >> (8 * (size - 1 - i)) );
+	}
+
+	static void set_byte( Key& k, size_t i, unsigned char b )
+	{
+		size_t shift = 8 * (size - 1 - i);
+		k = (Key)( (k & ~((Key)0xFF << shift)) | ((Key)b << shift) );
+	}
+};
+
+template<size_t N>
+struct fixed_key_traits< fixed_bytes<N> >
+{
+	static const size_t size = N;
+
+	static unsigned char byte( const fixed_bytes<N>& k, size_t i ) { return k.data[i]; }
+	static void set_byte( fixed_bytes<N>& k, size_t i, unsigned char b ) { k.data[i] = b; }
+};
+
+template<typename T, typename Key, typename Traits = fixed_key_traits<Key> >
+class tst_fixed_map
+{
+public:
+	typedef tnode<T, unsigned char>* node_ptr;
+	typedef Key key_type;
+
+	typedef T value_type;
+	typedef T& reference;
+	typedef T* pointer;
+	typedef T const& const_reference;
+	typedef T const* const_pointer;
+
+	static const size_t depth = Traits::size;
+
+public:
+	tst_fixed_map()
+		: root_(0), size_(0) {}
+
+	tst_fixed_map( const tst_fixed_map& m )
+		: root_(0), size_(0)
+	{
+		m.foreach( __insert_helper(*this) );
+	}
+
+	template<typename Iter>
+	tst_fixed_map( Iter beg, Iter end )
+		: root_(0), size_(0)
+	{
+		while ( beg != end )
+		{
+			insert( beg->first, beg->second );
+			++beg;
+		}
+	}
+
+	tst_fixed_map& operator = ( const tst_fixed_map& m )
+	{
+		if ( this != &m )
+		{
+			clear();
+			m.foreach( __insert_helper(*this) );
+		}
+		return *this;
+	}
+
+	~tst_fixed_map()
+	{
+		__destroy( root_ );
+	}
+
+	pointer insert( const Key& k, const T& val )// may be just update if exist
+	{
+		node_ptr p = __make_path( k );
+		if ( p->pdata )
+			*(p->pdata) = val;
+		else
+		{
+			++size_;
+			p->pdata = new T( val );
+		}
+		return p->pdata;
+	}
+
+	pointer insert( const std::pair<Key, T>& pair_val )
+	{
+		return insert( pair_val.first, pair_val.second );
+	}
+
+	pointer find( const Key& k ) { return __find( k ); }
+
+	const_pointer find( const Key& k ) const { return __find( k ); }
+
+	reference operator[]( const Key& k ) { return *__slot( k ); }
+
+	const T operator[]( const Key& k ) const
+	{
+		const T* pos = find(k);
+		return pos ? *pos : T();
+	}
+
+	bool remove( const Key& k ) // nodes left without any key are freed
+	{
+		bool removed = false;
+		root_ = __remove( root_, k, 0, removed );
+		return removed;
+	}
+
+	bool erase( const Key& k ) { return remove(k); }
+
+	void clear()
+	{
+		__destroy( root_ );
+	}
+
+	void swap( tst_fixed_map& m )
+	{
+		std::swap( root_, m.root_ );
+		std::swap( size_, m.size_ );
+	}
+
+	size_t size() const { return size_; }
+
+	bool empty() const { return size_==0; }
+
+	template<typename Func>
+	void foreach( Func f ) // in key order, f( const Key&, T& )
+	{
+		Key k = Key();
+		__travel( root_, 0, k, f );
+	}
+
+	template<typename Func>
+	void foreach( Func f ) const
+	{
+		Key k = Key();
+		__travel( root_, 0, k, f );
+	}
+
+	template< typename Seq > // value_type: pair<Key, T>
+	void sequence( Seq& c ) const
+	{
+		c.clear();
+		foreach( __push_back<Seq>(c) );
+	}
+
+	node_ptr root() const { return root_; }
+
+private: // inner use for implement
+	// the loop bound is the compile-time depth, so the descent unrolls and
+	// never looks for a terminator
+	node_ptr __terminal( const Key& k ) const
+	{
+		node_ptr p = root_;
+		for ( size_t i = 0; i < depth; ++i )
+		{
+			unsigned char c = Traits::byte( k, i );
+			while ( p && c != p->splitchar )
+				p = c < p->splitchar ? p->lokid : p->hikid;
+			if ( !p || i+1 == depth )
+				return p;
+			p = p->eqkid;
+		}
+		return 0;
+	}
+
+	pointer __find( const Key& k ) const
+	{
+		node_ptr p = __terminal( k );
+		return p ? p->pdata : 0;
+	}
+
+	pointer __slot( const Key& k ) // find or create the value of k
+	{
+		node_ptr p = __make_path( k );
+		if ( p->pdata == 0 )
+		{
+			++size_;
+			p->pdata = new T();
+		}
+		return p->pdata;
+	}
+
+	node_ptr __make_path( const Key& k ) // the last node of k, created if absent
+	{
+		node_ptr* link = &root_;
+		node_ptr p = 0;
+		for ( size_t i = 0; i < depth; ++i )
+		{
+			unsigned char c = Traits::byte( k, i );
+			while ( *link && c != (*link)->splitchar )
+				link = c < (*link)->splitchar ? &(*link)->lokid : &(*link)->hikid;
+			if ( *link == 0 )
+				*link = new tnode<T, unsigned char>( c );
+			p = *link;
+			link = &p->eqkid;
+		}
+		return p;
+	}
+
+	node_ptr __remove( node_ptr p, const Key& k, size_t i, bool& removed )
+	{
+		if ( p==0 )
+			return p;
+
+		unsigned char c = Traits::byte( k, i );
+		if ( c < p->splitchar )
+			p->lokid = __remove( p->lokid, k, i, removed );
+		else if ( c == p->splitchar )
+		{
+			if ( i+1 == depth )
+			{
+				if ( p->pdata )
+				{
+					delete p->pdata;
+					p->pdata = 0;
+					--size_;
+					removed = true;
+				}
+			}
+			else
+				p->eqkid = __remove( p->eqkid, k, i+1, removed );
+		}
+		else
+			p->hikid = __remove( p->hikid, k, i, removed );
+
+		if ( !removed || p->pdata || p->eqkid )
+			return p;
+
+		// p leads to no key any more, unlink it from its BST level
+		node_ptr kid = 0;
+		if ( p->lokid == 0 || p->hikid == 0 )
+			kid = p->lokid ? p->lokid : p->hikid;
+		else
+		{// replace p by the greatest node of its lokid subtree
+			node_ptr* link = &p->lokid;
+			while ( (*link)->hikid )
+				link = &(*link)->hikid;
+			kid = *link;
+			*link = kid->lokid;
+			kid->lokid = p->lokid;
+			kid->hikid = p->hikid;
+		}
+		delete p;
+		return kid;
+	}
+
+	template< typename Func >
+	static void __travel( node_ptr p, size_t i, Key& k, Func& f )
+	{
+		if ( !p )
+			return;
+		__travel( p->lokid, i, k, f );
+
+		Traits::set_byte( k, i, p->splitchar );
+		if ( i+1 == depth )
+		{
+			if ( p->pdata )
+				f( (const Key&)k, *(p->pdata) );
+		}
+		else
+			__travel( p->eqkid, i+1, k, f );
+
+		__travel( p->hikid, i, k, f );
+	}
+
+	void __destroy( node_ptr& p )
+	{
+		if ( p==0 )
+			return;
+		__destroy( p->lokid );
+		__destroy( p->eqkid );
+		__destroy( p->hikid );
+		if ( p->pdata )
+		{
+			delete p->pdata;
+			p->pdata = 0;
+			--size_;
+		}
+		delete p;
+		p = 0;
+	}
+
+	template< typename Seq >
+	struct __push_back
+	{
+		Seq& seq_;
+		__push_back( Seq& s ) : seq_(s) {}
+		void operator()( const Key& k, const T& t )
+		{
+			seq_.push_back( std::make_pair( k, t ) );
+		}
+	};
+
+	struct __insert_helper
+	{
+		tst_fixed_map& m_;
+		__insert_helper( tst_fixed_map& m ) : m_(m) {}
+		void operator()( const Key& k, const T& t )
+		{
+			m_.insert( k, t );
+		}
+	};
+
+private:
+	node_ptr root_;
+	size_t size_;
+};
+
+template<typename T, typename Key, typename Traits>
+void swap( tst_fixed_map<T, Key, Traits>& lhs, tst_fixed_map<T, Key, Traits>& rhs )
+{
+	lhs.swap( rhs );
+}
+
+} // namespace tst
+
+#endif // TST_FIXED_MAP_H
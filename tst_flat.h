@@ -0,0 +1,630 @@
+/*
+author: suninf
+description: the flat format stores a frozen tst in one file that is used in
+			 place: an array of nodes linked by index and a separate column
+			 of values. tst_flat_writer builds it from keys in sorted order,
+			 one level at a time, holding only the levels along the current
+			 key; tst_flat_map maps a flat file and searches it. freeze( m,
+			 path ) writes a tst_map out.
+
+			 file: flat_header, then the nodes, then the value column
+			 node i: lokid, hikid, eqkid, value (slot + 1, 0 none), splitchar;
+					 node 0 is unused so that 0 links nothing
+			 the nodes of one level are stored together, in order, and every
+			 subtree takes one run of the array ending with its top level.
+			 The value column is encoded by a Column policy (tst_column.h),
+			 raw T by default; all fields are in native byte order.
+*/
+
+#ifndef TST_FLAT_H
+#define TST_FLAT_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "tst_map.h"
+#include "tst_algorithm.h" // tst_walker
+#include "tst_column.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tst {
+
+struct flat_header
+{
+	char magic[8];                   // "TSTFLAT1"
+	unsigned int char_size;
+	unsigned int index_size;
+	unsigned int value_size;
+	unsigned int page_size;          // nodes never straddle a page this big, 0 packed
+	unsigned int column;             // Column::kind
+	unsigned int reserved;
+	unsigned long long nodes;        // counting node 0
+	unsigned long long values;
+	unsigned long long root;
+	unsigned long long nodes_offset;
+	unsigned long long values_offset;
+	unsigned long long values_bytes;
+};
+
+template<typename Ch, typename Index>
+struct flat_node
+{
+	Index lokid, hikid, eqkid;
+	Index value; // slot + 1 in the value column, 0 for none
+	Ch splitchar;
+};
+
+inline const char* __flat_magic() { return "TSTFLAT1"; }
+
+// file offset of node i
+inline unsigned long long __flat_node_offset( const flat_header& h, unsigned long long i,
+	size_t node_size )
+{
+	if ( !h.page_size )
+		return h.nodes_offset + i * node_size;
+	unsigned long long per_page = h.page_size / node_size;
+	return h.nodes_offset + ( i / per_page ) * h.page_size + ( i % per_page ) * node_size;
+}
+
+template<typename T, typename Ch = char, typename Comp = std::less<Ch>,
+	typename Index = unsigned int, typename Column = raw_column<T> >
+class tst_flat_writer
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef flat_node<Ch, Index> node_type;
+	typedef Column column_type;
+
+public:
+	tst_flat_writer() : f_(0), vf_(0), ok_(false) {}
+
+	~tst_flat_writer()
+	{
+		__close_files();
+		if ( !path_.empty() )
+			std::remove( (path_ + ".values.tmp").c_str() );
+	}
+
+	// page_size 0 packs the nodes; else no node straddles a page_size block
+	bool open( const std::string& path, unsigned int page_size = 0 )
+	{
+		__close_files();
+		path_ = path;
+		levels_.clear();
+		prev_.clear();
+		std::memset( &h_, 0, sizeof(h_) );
+		std::memcpy( h_.magic, __flat_magic(), 8 );
+		h_.char_size = sizeof(Ch);
+		h_.index_size = sizeof(Index);
+		h_.value_size = sizeof(T);
+		h_.page_size = page_size;
+		h_.column = Column::kind;
+		enc_ = typename Column::encoder();
+		if ( page_size && page_size < sizeof(node_type) )
+			return false;
+		h_.nodes_offset = page_size ? ( sizeof(flat_header) + page_size - 1 ) / page_size * page_size
+			: __align( sizeof(flat_header) );
+
+		std::remove( (path + ".mph").c_str() ); // an index of the old file (tst_mph.h)
+		f_ = std::fopen( path.c_str(), "wb" );
+		vf_ = std::fopen( (path + ".values.tmp").c_str(), "w+b" );
+		pos_ = 0;
+		ok_ = f_ && vf_ && std::fwrite( &h_, sizeof(h_), 1, f_ ) == 1;
+		pos_ = sizeof(h_);
+		node_type unused;
+		std::memset( &unused, 0, sizeof(unused) );
+		__write_node( unused ); // node 0
+		return ok_;
+	}
+
+	// keys must come in strictly increasing order by Comp; false otherwise
+	bool add( const tstring& key, const T& val )
+	{
+		if ( !ok_ || key.empty() )
+			return false;
+		size_t c = 0;
+		if ( h_.values > 0 )
+		{
+			while ( c < prev_.size() && c < key.size()
+				&& !comp_( prev_[c], key[c] ) && !comp_( key[c], prev_[c] ) )
+				++c;
+			if ( c == key.size() || ( c < prev_.size() && comp_( key[c], prev_[c] ) ) )
+				return false;
+		}
+
+		while ( levels_.size() > c + 1 ) // the levels below the fork are complete
+			__close_level();
+		for ( size_t d = c; d < key.size(); ++d )
+		{
+			__entry e = { key[d], 0, 0 };
+			if ( d < levels_.size() )
+				levels_[d].push_back( e );
+			else
+				levels_.push_back( std::vector<__entry>( 1, e ) );
+		}
+
+		levels_.back().back().value = (Index)( ++h_.values );
+		ok_ = ok_ && enc_.add( vf_, val );
+		prev_ = key;
+		return ok_;
+	}
+
+	bool finish() // writes out the rest; the file is complete if true
+	{
+		if ( !f_ )
+			return false;
+		while ( !levels_.empty() )
+			__close_level();
+
+		h_.values_offset = __align( pos_ );
+		__pad_to( h_.values_offset );
+		ok_ = ok_ && std::fflush( vf_ ) == 0 && std::fseek( vf_, 0, SEEK_SET ) == 0
+			&& enc_.write( vf_, f_, h_.values, h_.values_bytes );
+
+		ok_ = ok_ && std::fseek( f_, 0, SEEK_SET ) == 0
+			&& std::fwrite( &h_, sizeof(h_), 1, f_ ) == 1;
+		bool ok = __close_files() && ok_;
+		std::remove( (path_ + ".values.tmp").c_str() );
+		path_.clear();
+		return ok;
+	}
+
+	size_t size() const { return (size_t)h_.values; }
+
+private: // inner use for implement
+	struct __entry
+	{
+		Ch ch;
+		Index value;
+		Index eq;
+	};
+
+	static unsigned long long __align( unsigned long long n ) { return ( n + 7 ) & ~(unsigned long long)7; }
+
+	// writes the deepest level as a balanced BST, its nodes in key order
+	void __close_level()
+	{
+		std::vector<__entry>& e = levels_.back();
+		Index base = (Index)h_.nodes;
+		std::vector<Index> lo( e.size(), 0 ), hi( e.size(), 0 );
+		Index top = __link( base, 0, e.size(), lo, hi );
+		for ( size_t j = 0; j < e.size(); ++j )
+		{
+			node_type n;
+			std::memset( &n, 0, sizeof(n) );
+			n.lokid = lo[j];
+			n.hikid = hi[j];
+			n.eqkid = e[j].eq;
+			n.value = e[j].value;
+			n.splitchar = e[j].ch;
+			__write_node( n );
+		}
+		levels_.pop_back();
+		if ( levels_.empty() )
+			h_.root = top;
+		else
+			levels_.back().back().eq = top;
+	}
+
+	static Index __link( Index base, size_t a, size_t b, std::vector<Index>& lo, std::vector<Index>& hi )
+	{
+		if ( a >= b )
+			return 0;
+		size_t mid = a + ( b - a ) / 2;
+		lo[mid] = __link( base, a, mid, lo, hi );
+		hi[mid] = __link( base, mid + 1, b, lo, hi );
+		return (Index)( base + mid );
+	}
+
+	void __pad_to( unsigned long long off )
+	{
+		static const char zeros[256] = { 0 };
+		while ( ok_ && pos_ < off )
+		{
+			size_t n = (size_t)( off - pos_ < sizeof(zeros) ? off - pos_ : sizeof(zeros) );
+			ok_ = std::fwrite( zeros, 1, n, f_ ) == n;
+			pos_ += n;
+		}
+	}
+
+	void __write_node( const node_type& n )
+	{
+		__pad_to( __flat_node_offset( h_, h_.nodes, sizeof(node_type) ) );
+		ok_ = ok_ && std::fwrite( &n, sizeof(n), 1, f_ ) == 1;
+		pos_ += sizeof(n);
+		++h_.nodes;
+	}
+
+	bool __close_files()
+	{
+		bool ok = true;
+		if ( f_ )
+			ok = std::fclose( f_ ) == 0;
+		if ( vf_ )
+			std::fclose( vf_ );
+		f_ = vf_ = 0;
+		return ok;
+	}
+
+	tst_flat_writer( const tst_flat_writer& );
+	tst_flat_writer& operator = ( const tst_flat_writer& );
+
+private:
+	std::FILE* f_;
+	std::FILE* vf_; // the values as added, encoded into f_ at the end
+	typename Column::encoder enc_;
+	std::string path_;
+	flat_header h_;
+	unsigned long long pos_;
+	bool ok_;
+	std::vector< std::vector<__entry> > levels_; // [d]: siblings at depth d along prev_
+	tstring prev_;
+	Comp comp_;
+};
+
+// find( key ) returns a pointer into the file, so it needs raw_column;
+// find( key, val ) works with every column
+template<typename T, typename Ch = char, typename Comp = std::less<Ch>,
+	typename Index = unsigned int, typename Column = raw_column<T> >
+class tst_flat_map
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef flat_node<Ch, Index> node_type;
+	typedef tstring key_type;
+	typedef Comp key_compare;
+	typedef Index index_type;
+	typedef Column column_type;
+
+	typedef T value_type;
+	typedef T const& const_reference;
+	typedef T const* const_pointer;
+
+public:
+	tst_flat_map() : data_(0), len_(0), mapped_(false), owned_(false) {}
+
+	~tst_flat_map()
+	{
+		close();
+	}
+
+	bool open( const std::string& path )
+	{
+		close();
+#ifndef _WIN32
+		int fd = ::open( path.c_str(), O_RDONLY );
+		if ( fd < 0 )
+			return false;
+		struct stat st;
+		if ( fstat( fd, &st ) == 0 && st.st_size > 0 )
+		{
+			void* p = mmap( 0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+			if ( p != MAP_FAILED )
+			{
+				data_ = (const char*)p;
+				len_ = (size_t)st.st_size;
+				mapped_ = true;
+			}
+		}
+		::close( fd );
+#else
+		std::FILE* f = std::fopen( path.c_str(), "rb" );
+		if ( !f )
+			return false;
+		std::string buf;
+		char tmp[1 << 16];
+		size_t n;
+		while ( (n = std::fread( tmp, 1, sizeof(tmp), f )) > 0 )
+		{
+			buf.append( tmp, n );
+		}
+		std::fclose( f );
+		if ( !buf.empty() )
+		{
+			char* p = new char[ buf.size() ];
+			std::memcpy( p, buf.data(), buf.size() );
+			data_ = p;
+			len_ = buf.size();
+			owned_ = true;
+		}
+#endif
+		return __attach();
+	}
+
+	// a flat image of len bytes at p, 8-byte aligned, owned by the caller and
+	// kept alive and unchanged until close
+	bool open_memory( const void* p, size_t len )
+	{
+		close();
+		data_ = (const char*)p;
+		len_ = len;
+		return __attach();
+	}
+
+	void close()
+	{
+#ifndef _WIN32
+		if ( data_ && mapped_ )
+			munmap( (void*)data_, len_ );
+#endif
+		if ( data_ && owned_ )
+			delete [] data_;
+		data_ = 0;
+		len_ = 0;
+		mapped_ = false;
+		owned_ = false;
+	}
+
+	bool is_open() const { return data_ != 0; }
+
+	const_pointer find( const tstring& str ) const
+	{
+		return find_n( str.data(), str.size() );
+	}
+
+	// key [s, s+n); not a find overload, find( "key", v ) must not land here
+	const_pointer find_n( const Ch* s, size_t n ) const // exist if not return 0
+	{
+		Index i = __descend( s, n );
+		return i ? value( node(i).value ) : 0;
+	}
+
+	bool find( const tstring& str, T& val ) const
+	{
+		return find_n( str.data(), str.size(), val );
+	}
+
+	bool find_n( const Ch* s, size_t n, T& val ) const // val decoded from the column
+	{
+		Index i = __descend( s, n );
+		if ( !i || !node(i).value )
+			return false;
+		val = get( node(i).value );
+		return true;
+	}
+
+	bool has_prefix( const tstring& prefix ) const // some key starts with prefix
+	{
+		if ( prefix.empty() )
+			return size() > 0;
+		Index i = __descend( prefix.data(), prefix.size() );
+		return i && ( node(i).value || node(i).eqkid );
+	}
+
+	// pair( key, value ) of every key starting with prefix, in key order
+	template< typename Seq >
+	void prefix_search( const tstring& prefix, Seq& c ) const
+	{
+		c.clear();
+		if ( prefix.empty() )
+		{
+			sequence( c );
+			return;
+		}
+		Index i = __descend( prefix.data(), prefix.size() );
+		if ( !i )
+			return;
+		tstring str( prefix );
+		if ( node(i).value )
+			c.push_back( std::make_pair( str, T( get( node(i).value ) ) ) );
+		__push_back<Seq> f(c);
+		__walk( node(i).eqkid, str, f );
+	}
+
+	template< typename Seq >
+	void pmsearch( const tstring& str, Seq& c ) const // '.' matches any character
+	{
+		tstring strtmp;
+		c.clear();
+		if ( is_open() )
+			__pmsearch( root(), str.c_str(), strtmp, c );
+	}
+
+	template< typename Seq >
+	void sequence( Seq& c ) const
+	{
+		__push_back<Seq> f(c);
+		c.clear();
+		foreach_ref( f );
+	}
+
+	template<typename Func>
+	void foreach( Func f ) const // f( const tstring&, const T& ) in key order
+	{
+		foreach_ref( f );
+	}
+
+	template<typename Func>
+	void foreach_ref( Func& f ) const
+	{
+		tstring str;
+		if ( is_open() )
+			__walk( root(), str, f );
+	}
+
+	size_t size() const { return is_open() ? (size_t)h_.values : 0; }
+
+	bool empty() const { return size() == 0; }
+
+	// low-level access, for the structures built on the flat format
+	const flat_header& header() const { return h_; }
+
+	const char* image() const { return data_; } // the whole file, image_size() bytes
+
+	size_t image_size() const { return len_; }
+
+	Index root() const { return (Index)h_.root; }
+
+	const node_type& node( Index i ) const
+	{
+		return *(const node_type*)( data_ + __flat_node_offset( h_, i, sizeof(node_type) ) );
+	}
+
+	const_pointer value( Index slot ) const // slot as in node_type::value, 0 none; raw_column
+	{
+		return slot ? column_.pointer( slot - 1 ) : 0;
+	}
+
+	typename Column::result_type get( Index slot ) const // slot not 0
+	{
+		return column_.get( slot - 1 );
+	}
+
+	const typename Column::decoder& column() const { return column_; }
+
+private: // inner use for implement
+	bool __attach() // checks the image at data_ and opens the column
+	{
+		if ( !__valid() )
+		{
+			close();
+			return false;
+		}
+		std::memcpy( &h_, data_, sizeof(h_) );
+		if ( !column_.open( data_ + h_.values_offset, h_.values_bytes, h_.values ) )
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	bool __valid() const
+	{
+		if ( !data_ || len_ < sizeof(flat_header) )
+			return false;
+		flat_header h;
+		std::memcpy( &h, data_, sizeof(h) );
+		if ( std::memcmp( h.magic, __flat_magic(), 8 ) != 0 || h.char_size != sizeof(Ch)
+			|| h.index_size != sizeof(Index) || h.value_size != sizeof(T) || h.nodes == 0
+			|| h.column != (unsigned int)Column::kind
+			|| ( h.page_size && h.page_size < sizeof(node_type) ) )
+			return false;
+		return __flat_node_offset( h, h.nodes - 1, sizeof(node_type) ) + sizeof(node_type) <= len_
+			&& h.values_offset <= len_ && len_ - h.values_offset >= h.values_bytes
+			&& h.root < h.nodes;
+	}
+
+	Index __descend( const Ch* s, size_t n ) const // the node of the last character, 0 if none
+	{
+		if ( !is_open() || n == 0 )
+			return 0;
+		const Ch* e = s + n;
+		Index i = root();
+		while ( i )
+		{
+			const node_type& p = node(i);
+			if ( comp_( *s, p.splitchar ) )
+				i = p.lokid;
+			else if ( comp_( p.splitchar, *s ) )
+				i = p.hikid;
+			else
+			{
+				if ( ++s == e )
+					return i;
+				i = p.eqkid;
+			}
+		}
+		return 0;
+	}
+
+	template< typename Func >
+	void __walk( Index i, tstring& cur_str, Func& f ) const
+	{
+		if ( !i )
+			return;
+		const node_type& p = node(i);
+		__walk( p.lokid, cur_str, f );
+		cur_str.push_back( p.splitchar );
+		if ( p.value )
+			f( (const tstring&)cur_str, (const T&)get( p.value ) );
+		__walk( p.eqkid, cur_str, f );
+		cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		__walk( p.hikid, cur_str, f );
+	}
+
+	template< typename Seq >
+	void __pmsearch( Index i, const Ch* s, tstring& cur_str, Seq& c ) const
+	{
+		if ( *s == 0 || !i )
+			return;
+		const node_type& p = node(i);
+		if ( *s=='.' || comp_(*s, p.splitchar) )
+		{
+			__pmsearch( p.lokid, s, cur_str, c );
+		}
+		if ( *s=='.' || ( !comp_(*s, p.splitchar) && !comp_( p.splitchar, *s ) ) )
+		{
+			cur_str.push_back( p.splitchar );
+			if ( *(s+1) == 0 && p.value )
+			{
+				c.push_back( std::make_pair( cur_str, T( get( p.value ) ) ) );
+			}
+			else if ( *(s+1) )
+			{
+				__pmsearch( p.eqkid, s+1, cur_str, c );
+			}
+			cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		}
+		if ( *s=='.' || comp_( p.splitchar, *s ) )
+		{
+			__pmsearch( p.hikid, s, cur_str, c );
+		}
+	}
+
+	template< typename Seq >
+	struct __push_back
+	{
+		Seq& c_;
+		__push_back( Seq& c ) : c_(c) {}
+		void operator()( const tstring& str, const T& t )
+		{
+			c_.push_back( std::make_pair( str, t ) );
+		}
+	};
+
+	tst_flat_map( const tst_flat_map& ); // owns the mapping, not copyable
+	tst_flat_map& operator = ( const tst_flat_map& );
+
+private:
+	const char* data_;
+	size_t len_;
+	bool mapped_;
+	bool owned_; // data_ from new []
+	flat_header h_;
+	typename Column::decoder column_;
+	Comp comp_;
+};
+
+// adds the entries of m to an open writer and finishes it
+template<typename Map, typename Writer>
+bool write_flat( const Map& m, Writer& w )
+{
+	tst_walker<Map> it( m );
+	while ( it.next() )
+	{
+		if ( !w.add( it.key(), *it.value() ) )
+			return false;
+	}
+	return w.finish();
+}
+
+// writes m to path in the flat format, with 32-bit node indices
+template<typename T, typename Ch, typename Comp>
+bool freeze( const tst_map<T, Ch, Comp>& m, const std::string& path, unsigned int page_size = 0 )
+{
+	tst_flat_writer<T, Ch, Comp> w;
+	return w.open( path, page_size ) && write_flat( m, w );
+}
+
+} // namespace tst
+
+#endif // TST_FLAT_H
@@ -0,0 +1,526 @@
+/*
+author: suninf
+description: tst_linked_map is a tst_map whose nodes also link to their parent.
+			 Walking up from the node where a key ends spells the key, so
+			 key_of( p ) turns a value pointer from insert or find back into
+			 its key in O(depth), without a foreach. Iterators step to the next
+			 key in key order through the parent links, with no stack.
+
+			 a value is allocated together with a link to its node, and nodes
+			 are never moved, so value pointers and iterators stay valid until
+			 their own key is removed. One pointer more per node than tst_map.
+
+			 a handle names the node of one key: get, set, key and erase on a
+			 handle skip the descent, for callers that touch the same keys over
+			 and over. insert_handle / find_handle hand them out.
+*/
+
+#ifndef TST_LINKED_MAP_H
+#define TST_LINKED_MAP_H
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include "tst_map.h"
+
+namespace tst {
+
+template< typename T, typename Ch >
+struct linked_tnode
+{
+	typedef linked_tnode* node_ptr;
+	linked_tnode( Ch ch, node_ptr up ) :
+	splitchar(ch), lokid(0), hikid(0), eqkid(0), parent(up), pdata(0) {}
+
+	Ch splitchar;
+	node_ptr lokid, hikid, eqkid;
+	node_ptr parent; // 0 for the root
+	T* pdata;
+};
+
+template<typename T, typename Ch = char, typename Comp = std::less<Ch> >
+class tst_linked_map
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef linked_tnode<T,Ch> node_type;
+	typedef linked_tnode<T,Ch>* node_ptr;
+	typedef tstring key_type;
+	typedef Comp key_compare;
+
+	typedef T value_type;
+	typedef T& reference;
+	typedef T* pointer;
+	typedef T const& const_reference;
+	typedef T const* const_pointer;
+
+	// forward iterator in key order; V is T or const T
+	template<typename V>
+	class basic_iterator
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef V value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef V* pointer;
+		typedef V& reference;
+
+		basic_iterator() : p_(0) {}
+		explicit basic_iterator( node_ptr p ) : p_(p) {}
+		template<typename U>
+		basic_iterator( const basic_iterator<U>& it ) : p_( it.node() ) {}
+
+		tstring key() const { return tst_linked_map::__key( p_ ); }
+		reference value() const { return *p_->pdata; }
+		reference operator*() const { return *p_->pdata; }
+		pointer operator->() const { return p_->pdata; }
+
+		basic_iterator& operator++()
+		{
+			p_ = tst_linked_map::__next_value( p_ );
+			return *this;
+		}
+
+		basic_iterator operator++( int )
+		{
+			basic_iterator it( *this );
+			++*this;
+			return it;
+		}
+
+		template<typename U>
+		bool operator==( const basic_iterator<U>& it ) const { return p_ == it.node(); }
+		template<typename U>
+		bool operator!=( const basic_iterator<U>& it ) const { return p_ != it.node(); }
+
+		node_ptr node() const { return p_; }
+
+	private:
+		node_ptr p_;
+	};
+
+	typedef basic_iterator<T> iterator;
+	typedef basic_iterator<const T> const_iterator;
+
+	// the node of a key, valid until that key is removed; a default handle names no key
+	class handle
+	{
+	public:
+		handle() : p_(0) {}
+
+		bool valid() const { return p_ != 0; }
+
+		bool operator==( const handle& h ) const { return p_ == h.p_; }
+		bool operator!=( const handle& h ) const { return p_ != h.p_; }
+
+	private:
+		explicit handle( node_ptr p ) : p_(p) {}
+
+		node_ptr p_;
+
+		friend class tst_linked_map;
+	};
+
+public:
+	tst_linked_map()
+		: root_(0), size_(0) {}
+
+	tst_linked_map( const tst_linked_map& m )
+		: root_(0), size_(0)
+	{
+		m.foreach( __insert_helper(*this) );
+	}
+
+	template<typename Iter>
+	tst_linked_map( Iter beg, Iter end )
+		: root_(0), size_(0)
+	{
+		insert( beg, end );
+	}
+
+	tst_linked_map& operator = ( const tst_linked_map& m )
+	{
+		if ( this != &m )
+		{
+			clear();
+			m.foreach( __insert_helper(*this) );
+		}
+		return *this;
+	}
+
+	~tst_linked_map()
+	{
+		clear();
+	}
+
+	pointer insert( const tstring& str, const T& val ) // may be just update if exist
+	{
+		node_ptr p = __make_path( str );
+		if ( !p )
+			return 0;
+		if ( p->pdata )
+			*(p->pdata) = val;
+		else
+			__attach( p, __new_value( val, p ) );
+		return p->pdata;
+	}
+
+	template<typename Iter>
+	void insert( Iter beg, Iter end ) // insert [beg, end), value_type: pair<string, T>
+	{
+		while ( beg != end )
+		{
+			insert( beg->first, beg->second );
+			++beg;
+		}
+	}
+
+	pointer insert( const std::pair<tstring, T>& pair_val )
+	{
+		return insert( pair_val.first, pair_val.second );
+	}
+
+	pointer find( const tstring& str ) // exist if not return 0
+	{
+		node_ptr p = __find_node( str.data(), str.size() );
+		return p ? p->pdata : 0;
+	}
+
+	const_pointer find( const tstring& str ) const
+	{
+		node_ptr p = __find_node( str.data(), str.size() );
+		return p ? p->pdata : 0;
+	}
+
+	reference operator[]( const tstring& str ) // str not empty
+	{
+		node_ptr p = __make_path( str );
+		if ( !p->pdata )
+			__attach( p, __new_value( T(), p ) );
+		return *(p->pdata);
+	}
+
+	// the key of a value pointer returned by insert, find or operator[]
+	tstring key_of( const_pointer v ) const
+	{
+		return __key( __owner( v ) );
+	}
+
+	iterator iterator_of( pointer v ) { return iterator( __owner( v ) ); }
+
+	handle insert_handle( const tstring& str, const T& val ) // as insert; invalid for an empty key
+	{
+		pointer v = insert( str, val );
+		return v ? handle( __owner( v ) ) : handle();
+	}
+
+	handle find_handle( const tstring& str ) const // invalid if absent
+	{
+		node_ptr p = __find_node( str.data(), str.size() );
+		return p && p->pdata ? handle( p ) : handle();
+	}
+
+	handle handle_of( const_pointer v ) const { return handle( __owner( v ) ); }
+
+	// h valid for the calls below
+	reference get( handle h ) { return *h.p_->pdata; }
+
+	const_reference get( handle h ) const { return *h.p_->pdata; }
+
+	void set( handle h, const T& val ) { *h.p_->pdata = val; }
+
+	tstring key( handle h ) const { return __key( h.p_ ); }
+
+	void erase( handle h ) { __erase_node( h.p_ ); } // h and its copies are invalid after
+
+	const_iterator iterator_of( const_pointer v ) const { return const_iterator( __owner( v ) ); }
+
+	bool remove( const tstring& str ) // nodes left without any key are freed
+	{
+		node_ptr p = __find_node( str.data(), str.size() );
+		if ( !p || !p->pdata )
+			return false;
+		__erase_node( p );
+		return true;
+	}
+
+	bool erase( const tstring& str ) { return remove( str ); }
+
+	iterator erase( iterator it ) // the iterator to the next key
+	{
+		node_ptr next = __next_value( it.node() );
+		__erase_node( it.node() );
+		return iterator( next );
+	}
+
+	iterator begin() { return iterator( __first_value( root_ ) ); }
+	iterator end() { return iterator(); }
+	const_iterator begin() const { return const_iterator( __first_value( root_ ) ); }
+	const_iterator end() const { return const_iterator(); }
+
+	template<typename Func>
+	void foreach( Func f ) const // f( const tstring&, const T& ) in key order
+	{
+		for ( const_iterator it = begin(); it != end(); ++it )
+		{
+			f( it.key(), *it );
+		}
+	}
+
+	template< typename Seq > // for vector,deque,list, value_type: pair<string, T>
+	void sequence( Seq& c ) const
+	{
+		c.clear();
+		for ( const_iterator it = begin(); it != end(); ++it )
+		{
+			c.push_back( std::make_pair( it.key(), *it ) );
+		}
+	}
+
+	void clear()
+	{
+		__destroy( root_ );
+		root_ = 0;
+		size_ = 0;
+	}
+
+	void swap( tst_linked_map& m )
+	{
+		std::swap( root_, m.root_ );
+		std::swap( size_, m.size_ );
+	}
+
+	size_t size() const { return size_; }
+
+	bool empty() const { return size_ == 0; }
+
+	node_ptr root() const { return root_; }
+
+private: // inner use for implement
+	// a value block is the owner link, padded to __head bytes, then the
+	// value, so the link is found __head bytes before any value pointer
+	union __max_align
+	{
+		node_ptr p;
+		long double d;
+		long l;
+		void (*f)();
+	};
+	static const size_t __head = sizeof(__max_align); // keeps the value aligned
+
+	static T* __new_value( const T& val, node_ptr owner )
+	{
+		char* raw = (char*)::operator new( __head + sizeof(T) );
+		new ( raw ) node_ptr( owner );
+		try
+		{
+			return new ( raw + __head ) T( val );
+		}
+		catch ( ... )
+		{
+			::operator delete( raw );
+			throw;
+		}
+	}
+
+	static node_ptr __owner( const_pointer v )
+	{
+		return *reinterpret_cast<const node_ptr*>( (const char*)v - __head );
+	}
+
+	void __attach( node_ptr p, T* v )
+	{
+		p->pdata = v;
+		++size_;
+	}
+
+	static void __free_value( node_ptr p )
+	{
+		p->pdata->~T();
+		::operator delete( (char*)p->pdata - __head );
+		p->pdata = 0;
+	}
+
+	static tstring __key( node_ptr p )
+	{
+		tstring s( 1, p->splitchar );
+		for ( ; p->parent; p = p->parent )
+		{
+			if ( p->parent->eqkid == p )
+				s.push_back( p->parent->splitchar );
+		}
+		std::reverse( s.begin(), s.end() );
+		return s;
+	}
+
+	// key order visits the lokid subtree, the node itself, then eqkid and hikid
+	static node_ptr __first( node_ptr p )
+	{
+		while ( p && p->lokid )
+			p = p->lokid;
+		return p;
+	}
+
+	static node_ptr __next( node_ptr p )
+	{
+		if ( p->eqkid )
+			return __first( p->eqkid );
+		if ( p->hikid )
+			return __first( p->hikid );
+		for ( node_ptr up = p->parent; up; p = up, up = up->parent )
+		{
+			if ( up->lokid == p )
+				return up;
+			if ( up->eqkid == p && up->hikid )
+				return __first( up->hikid );
+		}
+		return 0;
+	}
+
+	static node_ptr __first_value( node_ptr p )
+	{
+		p = __first( p );
+		while ( p && !p->pdata )
+			p = __next( p );
+		return p;
+	}
+
+	static node_ptr __next_value( node_ptr p )
+	{
+		do
+			p = __next( p );
+		while ( p && !p->pdata );
+		return p;
+	}
+
+	node_ptr __find_node( const Ch* s, size_t n ) const
+	{
+		node_ptr p = root_;
+		const Ch* e = s + n;
+		if ( n == 0 )
+			return 0;
+		while ( p )
+		{
+			if ( comp_( *s, p->splitchar ) )
+				p = p->lokid;
+			else if ( comp_( p->splitchar, *s ) )
+				p = p->hikid;
+			else
+			{
+				if ( ++s == e )
+					return p;
+				p = p->eqkid;
+			}
+		}
+		return 0;
+	}
+
+	node_ptr __make_path( const tstring& str ) // the node of the last character, created if need
+	{
+		if ( str.empty() ) // ignore empty string
+			return 0;
+		const Ch* s = str.data();
+		const Ch* e = s + str.size();
+		node_ptr up = 0;
+		node_ptr* link = &root_;
+		while ( true )
+		{
+			if ( *link == 0 )
+				*link = new node_type( *s, up );
+			node_ptr p = *link;
+			if ( comp_( *s, p->splitchar ) )
+				link = &p->lokid;
+			else if ( comp_( p->splitchar, *s ) )
+				link = &p->hikid;
+			else
+			{
+				if ( ++s == e )
+					return p;
+				link = &p->eqkid;
+			}
+			up = p;
+		}
+	}
+
+	// drop the value of p, then free the nodes that lead to no key any more
+	void __erase_node( node_ptr p )
+	{
+		__free_value( p );
+		--size_;
+		while ( p && !p->pdata && !p->eqkid )
+		{
+			node_ptr up = p->parent;
+			node_ptr* link = up == 0 ? &root_
+				: up->lokid == p ? &up->lokid : up->hikid == p ? &up->hikid : &up->eqkid;
+			*link = __unlink( p );
+			p = ( *link == 0 && up && link == &up->eqkid ) ? up : 0;
+		}
+	}
+
+	node_ptr __unlink( node_ptr p ) // frees p, returns what takes its place in its BST level
+	{
+		node_ptr kid = 0;
+		if ( p->lokid == 0 || p->hikid == 0 )
+			kid = p->lokid ? p->lokid : p->hikid;
+		else
+		{// replace p by the greatest node of its lokid subtree
+			node_ptr owner = p;
+			node_ptr* link = &p->lokid;
+			while ( (*link)->hikid )
+			{
+				owner = *link;
+				link = &(*link)->hikid;
+			}
+			kid = *link;
+			*link = kid->lokid;
+			if ( kid->lokid )
+				kid->lokid->parent = owner;
+			kid->lokid = p->lokid;
+			kid->hikid = p->hikid;
+			if ( kid->lokid )
+				kid->lokid->parent = kid;
+			kid->hikid->parent = kid;
+		}
+		if ( kid )
+			kid->parent = p->parent;
+		delete p;
+		return kid;
+	}
+
+	void __destroy( node_ptr p )
+	{
+		if ( p == 0 )
+			return;
+		__destroy( p->lokid );
+		__destroy( p->eqkid );
+		__destroy( p->hikid );
+		if ( p->pdata )
+			__free_value( p );
+		delete p;
+	}
+
+	struct __insert_helper
+	{
+		tst_linked_map& m_;
+		__insert_helper( tst_linked_map& m ) : m_(m) {}
+		void operator()( const tstring& str, const T& t )
+		{
+			m_.insert( str, t );
+		}
+	};
+
+private:
+	Comp comp_;
+	node_ptr root_;
+	size_t size_;
+};
+
+template<typename T, typename Ch, typename Comp>
+void swap( tst_linked_map<T, Ch, Comp>& lhs, tst_linked_map<T, Ch, Comp>& rhs )
+{
+	lhs.swap( rhs );
+}
+
+} // namespace tst
+
+#endif // TST_LINKED_MAP_H
@@ -5,10 +5,15 @@ description: 
 			 ЧĻַΪkeyĹ
 */
 
+#ifndef TST_MAP_H
+#define TST_MAP_H
+
 #include <functional>
 #include <string>
 #include <utility>
 #include <iterator>
+#include <vector>
+#include <algorithm>
 using std::iterator_traits;
 
 namespace tst {
@@ -25,13 +30,36 @@ struct tnode
 	T* pdata;
 };
 
+struct tst_access;
+
+// merge policies, called as policy( mine, theirs ) for keys in both maps
+struct merge_replace
+{
+	template<typename T>
+	void operator()( T& mine, const T& theirs ) const { mine = theirs; }
+};
+
+struct merge_keep
+{
+	template<typename T>
+	void operator()( T&, const T& ) const {}
+};
+
+struct merge_add // counting: upsert( key, 1, merge_add() )
+{
+	template<typename T>
+	void operator()( T& mine, const T& theirs ) const { mine += theirs; }
+};
+
 template<typename T, typename Ch = char, typename Comp = std::less<Ch> >
 class tst_map
 {
 public:
 	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef tnode<T,Ch> node_type;
 	typedef tnode<T,Ch>* node_ptr;
 	typedef tstring	key_type;
+	typedef Comp key_compare;
 	
 	typedef T value_type;
 	typedef T& reference;
@@ -41,24 +69,24 @@ public:
 
 public:
 	tst_map() 
-		: root_(0), comp_(Comp()), size_(0) {}
+		: root_(0), comp_(Comp()), size_(0), garbage_(0) {}
 
 	tst_map( const tst_map& st ) // default copy ctor
-		: root_(0), comp_(Comp()), size_(0)
+		: root_(0), comp_(Comp()), size_(0), garbage_(0)
 	{
 		st.foreach( __insert_helper<tst_map>(*this) );
 	}
 	
 	template<typename U, typename Compare>
 	tst_map( const tst_map<U, Ch, Compare>& st )
-		: root_(0), comp_(Comp()), size_(0)
+		: root_(0), comp_(Comp()), size_(0), garbage_(0)
 	{
 		st.foreach( __insert_helper<tst_map>(*this) );
 	}
 
 	template<typename Iter>
 	tst_map( Iter beg, Iter end )
-		: root_(0), comp_(Comp()), size_(0)
+		: root_(0), comp_(Comp()), size_(0), garbage_(0)
 	{
 		while ( beg != end )
 		{
@@ -91,6 +119,7 @@ public:
 	~tst_map()
 	{
 		__destroy( root_ );
+		__reclaim( size_t(-1) );
 	}
 
 	pointer insert( const tstring& str, const T& val )// may be just update if exist
@@ -146,6 +175,66 @@ public:
 		return *pos;
 	}
 
+	// one descent: insert val if str is absent, else merge( *p, val ) in place,
+	// merge as the merge policies; 0 for an empty str
+	template<typename Merge>
+	pointer upsert( const tstring& str, const T& val, Merge merge )
+	{
+		if ( str.empty() )
+			return 0;
+		return __upsert( &root_, 0, str, val, merge, 0 );
+	}
+
+	// f( *p ) if str exists, no node is made; 0 if absent
+	template<typename Func>
+	pointer update_if_present( const tstring& str, Func f )
+	{
+		pointer p = find( str );
+		if ( p )
+			f( *p );
+		return p;
+	}
+
+	// upsert each pair of [beg, end), value_type: pair<string, T>. A key resumes
+	// the descent where it parts from the key before, so a sorted stream walks
+	// every shared prefix once; any order is still correct
+	template<typename Iter, typename Merge>
+	void upsert_batch( Iter beg, Iter end, Merge merge )
+	{
+		std::vector<node_ptr*> links; // links[d]: where level d was entered
+		tstring prev;
+		for ( ; beg != end; ++beg )
+		{
+			const tstring& str = beg->first;
+			if ( str.empty() )
+				continue;
+			size_t c = __common( prev, str, std::min( str.size(), prev.size() ) - 1 );
+			__upsert( c ? links[c] : &root_, c, str, beg->second, merge, &links );
+			prev = str;
+		}
+	}
+
+	// update_if_present for each key of [beg, end), value_type: string,
+	// resuming like upsert_batch
+	template<typename Iter, typename Func>
+	void update_batch( Iter beg, Iter end, Func f )
+	{
+		std::vector<node_ptr*> links( 1, &root_ );
+		size_t reach = 1; // links valid below reach
+		tstring prev;
+		for ( ; beg != end; ++beg )
+		{
+			const tstring& str = *beg;
+			if ( str.empty() )
+				continue;
+			size_t c = __common( prev, str, std::min( str.size(), reach ) - 1 );
+			node_ptr p = __locate( c, str, links, reach );
+			if ( p && p->pdata )
+				f( *(p->pdata) );
+			prev = str;
+		}
+	}
+
 	size_t size() { return size_; };
 
 	bool empty() { return size_==0; }
@@ -178,48 +267,75 @@ public:
 	void sequence( Seq& c )
 	{
 		tstring str;
+		__push_back<Seq> f(c);
 		c.clear();
-		__travel( root_, str, __push_back<Seq>(c) );
+		__travel( root_, str, f );
 	}
 
 	void swap( tst_map& m )
 	{
 		std::swap( root_, m.root_ );
 		std::swap( size_, m.size_ );
+		std::swap( garbage_, m.garbage_ );
 	}
 
-	bool remove( const tstring& str )
+	bool remove( const tstring& str ) // nodes left without any key are freed
 	{
-		node_ptr p = root_;
-		const Ch* s = str.c_str();
-		while ( p )
-		{
-			if ( comp_( *s, p->splitchar ) )
-				p = p->lokid;
-			else if ( !comp_(*s, p->splitchar) && !comp_( p->splitchar, *s ) )
-			{
-				if ( *(++s) == 0 && p->pdata )
-				{
-					delete p->pdata;
-					--size_;
-					p->pdata = 0;
-					return true;
-				}
-				p = p->eqkid;
-			} 
-			else
-				p = p->hikid;
-		}
-		return false;
+		bool removed = false;
+		root_ = __remove( root_, str.c_str(), removed );
+		return removed;
 	}
 
 	bool erase( const tstring& str ) { return remove(str); }
 
+	// move every entry of m into this map, m is left empty. Nodes of m are
+	// spliced in whole where this map has no node for their character, so a
+	// subtree absent here is linked in, not reinserted key by key
+	template<typename Policy>
+	void merge( tst_map& m, Policy policy )
+	{
+		if ( this == &m )
+			return;
+		size_t dups = 0;
+		root_ = __merge( root_, m.root_, policy, dups );
+		size_ += m.size_ - dups;
+		m.root_ = 0;
+		m.size_ = 0;
+	}
+
+	void merge( tst_map& m ) { merge( m, merge_replace() ); }
+
 	void clear()
 	{
 		__destroy( root_ );
 	}
 
+	// empty the map at once, but free its nodes budget at a time:
+	// the old tree is detached and reclaim() continues freeing it
+	bool clear_incremental( size_t budget ) // true if nothing is left to free
+	{
+		if ( root_ )
+		{
+			if ( garbage_ )
+			{// join both trees under a spare node
+				node_ptr p = new tnode<T,Ch>( Ch() );
+				p->lokid = garbage_;
+				p->hikid = root_;
+				root_ = p;
+			}
+			garbage_ = root_;
+			root_ = 0;
+			size_ = 0;
+		}
+		return reclaim( budget );
+	}
+
+	bool reclaim( size_t budget ) // true if nothing is left to free
+	{
+		__reclaim( budget );
+		return garbage_ == 0;
+	}
+
 	// const versions
 	const_pointer find( const tstring& str ) const// exist if not return 0
 	{
@@ -243,6 +359,28 @@ public:
 		return 0;
 	}
 
+	const_pointer find_n( const Ch* s, size_t n ) const // key [s, s+n), need not end with 0
+	{
+		node_ptr p = root_;
+		const Ch* e = s + n;
+		if ( n == 0 )
+			return 0;
+		while ( p )
+		{
+			if ( comp_( *s, p->splitchar ) )
+				p = p->lokid;
+			else if ( comp_( p->splitchar, *s ) )
+				p = p->hikid;
+			else
+			{
+				if ( ++s == e )
+					return p->pdata;
+				p = p->eqkid;
+			}
+		}
+		return 0;
+	}
+
 	template< typename Seq >
 	void pmsearch( const tstring& str, Seq& c ) const
 	{
@@ -255,8 +393,9 @@ public:
 	void sequence( Seq& c ) const
 	{
 		tstring str;
+		__push_back<Seq> f(c);
 		c.clear();
-		__travel( root_, str, __push_back<Seq>(c) );
+		__travel( root_, str, f );
 	}
 	template< typename Seq >
 	void nearsearch( const tstring& str, int d, Seq& c ) const
@@ -283,6 +422,9 @@ public:
 
 	bool empty() const { return size_==0; }
 
+	// low-level access to the node tree, for the adaptors built on tst_map
+	node_ptr root() const { return root_; }
+
 private: // inner use for implement
 	template< typename Seq >
 	void __pmsearch( node_ptr p, const Ch* s, tstring& cur_str, Seq& c )
@@ -421,6 +563,123 @@ private: // inner use for implement
 		return p;
 	}
 
+	// free detached nodes in at most budget steps with O(1) extra memory:
+	// a lokid is rotated up, an eqkid folded into the lokid slot, and a node
+	// without both is freed, continuing with its hikid
+	void __reclaim( size_t budget )
+	{
+		node_ptr& p = garbage_;
+		for ( size_t steps = 0; p && steps < budget; ++steps )
+		{
+			if ( p->lokid )
+			{
+				node_ptr l = p->lokid;
+				p->lokid = l->hikid;
+				l->hikid = p;
+				p = l;
+			}
+			else if ( p->eqkid )
+			{
+				p->lokid = p->eqkid;
+				p->eqkid = 0;
+			}
+			else
+			{
+				node_ptr next = p->hikid;
+				delete p->pdata;
+				delete p;
+				p = next;
+			}
+		}
+	}
+
+	// merge the level of b into the level of a, returns the new level root
+	template<typename Policy>
+	node_ptr __merge( node_ptr a, node_ptr b, Policy& policy, size_t& dups )
+	{
+		if ( b==0 )
+			return a;
+		node_ptr lo = b->lokid;
+		node_ptr hi = b->hikid;
+		b->lokid = b->hikid = 0;
+
+		node_ptr* link = &a;
+		while ( *link && ( comp_( b->splitchar, (*link)->splitchar )
+			|| comp_( (*link)->splitchar, b->splitchar ) ) )
+		{
+			link = comp_( b->splitchar, (*link)->splitchar ) ? &(*link)->lokid : &(*link)->hikid;
+		}
+
+		if ( *link == 0 )
+			*link = b; // with its whole eqkid subtree
+		else
+		{
+			node_ptr p = *link;
+			if ( b->pdata )
+			{
+				if ( p->pdata )
+				{
+					policy( *(p->pdata), *(const T*)b->pdata );
+					delete b->pdata;
+					++dups;
+				}
+				else
+					p->pdata = b->pdata;
+			}
+			p->eqkid = __merge( p->eqkid, b->eqkid, policy, dups );
+			delete b;
+		}
+
+		a = __merge( a, lo, policy, dups );
+		return __merge( a, hi, policy, dups );
+	}
+
+	node_ptr __remove( node_ptr p, const Ch* s, bool& removed )
+	{
+		if ( p==0 || *s == 0 )
+			return p;
+
+		if ( comp_( *s, p->splitchar ) )
+			p->lokid = __remove( p->lokid, s, removed );
+		else if ( !comp_(*s, p->splitchar) && !comp_( p->splitchar, *s ) )
+		{
+			if ( *(s+1) == 0 )
+			{
+				if ( p->pdata )
+				{
+					delete p->pdata;
+					p->pdata = 0;
+					--size_;
+					removed = true;
+				}
+			}
+			else
+				p->eqkid = __remove( p->eqkid, s+1, removed );
+		}
+		else
+			p->hikid = __remove( p->hikid, s, removed );
+
+		if ( !removed || p->pdata || p->eqkid )
+			return p;
+
+		// p leads to no key any more, unlink it from its BST level
+		node_ptr kid = 0;
+		if ( p->lokid == 0 || p->hikid == 0 )
+			kid = p->lokid ? p->lokid : p->hikid;
+		else
+		{// replace p by the greatest node of its lokid subtree
+			node_ptr* link = &p->lokid;
+			while ( (*link)->hikid )
+				link = &(*link)->hikid;
+			kid = *link;
+			*link = kid->lokid;
+			kid->lokid = p->lokid;
+			kid->hikid = p->hikid;
+		}
+		delete p;
+		return kid;
+	}
+
 	node_ptr __insert( node_ptr p, const Ch* s, pointer& pos ) // for operator[]
 	{
 		if ( *s == 0 )// ignore empty string
@@ -559,6 +818,78 @@ private: // inner use for implement
 		}
 	};
 
+	// length of the common prefix of a and b, at most limit
+	size_t __common( const tstring& a, const tstring& b, size_t limit ) const
+	{
+		size_t c = 0;
+		while ( c < limit && c < a.size() && !comp_( a[c], b[c] ) && !comp_( b[c], a[c] ) )
+			++c;
+		return c;
+	}
+
+	// descend from link, the entry to level d of str, making nodes as need;
+	// links, if given, record the entry to every level passed
+	template<typename Merge>
+	pointer __upsert( node_ptr* link, size_t d, const tstring& str, const T& val, Merge& merge,
+		std::vector<node_ptr*>* links )
+	{
+		if ( links )
+			links->resize( str.size() );
+		const Ch* s = str.data() + d;
+		const Ch* e = str.data() + str.size();
+		node_ptr p;
+		while ( true )
+		{
+			if ( links )
+				(*links)[s - str.data()] = link;
+			const Ch ch = *s;
+			while ( ( p = *link ) != 0 )
+			{
+				if ( comp_( ch, p->splitchar ) )
+					link = &p->lokid;
+				else if ( comp_( p->splitchar, ch ) )
+					link = &p->hikid;
+				else
+					break;
+			}
+			if ( p == 0 )
+				p = *link = new tnode<T,Ch>( ch );
+			if ( ++s == e )
+				break;
+			link = &p->eqkid;
+		}
+		if ( p->pdata )
+			merge( *(p->pdata), val );
+		else
+		{
+			++size_;
+			p->pdata = new T( val );
+		}
+		return p->pdata;
+	}
+
+	// the node of the last character of str, or 0, entering at level d;
+	// links[0, reach) hold the level entries of the path found
+	node_ptr __locate( size_t d, const tstring& str, std::vector<node_ptr*>& links, size_t& reach )
+	{
+		if ( links.size() < str.size() )
+			links.resize( str.size() );
+		node_ptr* link = links[d];
+		while ( true )
+		{
+			links[d] = link;
+			reach = d + 1;
+			node_ptr p = *link;
+			while ( p && ( comp_( str[d], p->splitchar ) || comp_( p->splitchar, str[d] ) ) )
+				p = comp_( str[d], p->splitchar ) ? p->lokid : p->hikid;
+			if ( p == 0 )
+				return 0;
+			if ( ++d == str.size() )
+				return p;
+			link = &p->eqkid;
+		}
+	}
+
 	static int __strlen( const Ch* s )
 	{
 		int len = 0;
@@ -572,7 +903,32 @@ private:
 	Comp comp_;
 	node_ptr root_;
 	size_t size_;
+	node_ptr garbage_; // detached by clear_incremental, not yet freed
+
+	friend struct tst_access;
+};
+
+// low-level hooks for the algorithm headers that build node trees directly
+struct tst_access
+{
+	// replace the content of m by the tree at root holding n keys
+	template<typename Map>
+	static void adopt( Map& m, typename Map::node_ptr root, size_t n )
+	{
+		m.clear();
+		m.root_ = root;
+		m.size_ = n;
+	}
 
+	// take the tree out of m, which is left empty
+	template<typename Map>
+	static typename Map::node_ptr release( Map& m )
+	{
+		typename Map::node_ptr root = m.root_;
+		m.root_ = 0;
+		m.size_ = 0;
+		return root;
+	}
 };
 
 template<typename T, typename Ch, typename Comp>
@@ -583,3 +939,5 @@ void swap( tst_map<T, Ch, Comp>& lhs, tst_map<T, Ch, Comp>& rhs )
 
 } // namespace tst
 
+#endif // TST_MAP_H
+
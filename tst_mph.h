@@ -0,0 +1,411 @@
+/*
+author: suninf
+description: an exact-match index for frozen maps. tst_mph is a minimal
+			 perfect hash in the BBHash manner: levels of bit arrays, each
+			 key placed at the first level where its hash does not collide,
+			 and a rank over the set bits numbering the keys 0..n-1. Each
+			 number holds the key's value slot and a 64-bit fingerprint of
+			 the key, the one compare that tells absent keys apart.
+
+			 tst_hashed_map pairs a flat map (tst_flat.h) with a tst_mph over
+			 its keys: find is a hash, a few bit probes and one compare, and
+			 the tree stays for prefix and pattern queries. The index is
+			 saved to <path>.mph by freeze_indexed, or built by open if the
+			 file is missing or stale: it holds a checksum of the whole flat
+			 image, and writing a flat file removes the index beside it.
+
+			 fingerprints make find exact unless two keys share a 64-bit
+			 hash: the build fails then, and an absent key is reported
+			 present with odds of about 2^-64; find_exact checks the tree too.
+*/
+
+#ifndef TST_MPH_H
+#define TST_MPH_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "tst_flat.h"
+
+namespace tst {
+
+inline unsigned long long __mix64( unsigned long long h ) // murmur3 finalizer
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+template<typename Ch>
+unsigned long long tst_key_hash( const Ch* s, size_t n ) // FNV-1a over the bytes, mixed
+{
+	const unsigned char* p = (const unsigned char*)s;
+	unsigned long long h = 14695981039346656037ULL;
+	for ( size_t i = 0; i < n * sizeof(Ch); ++i )
+	{
+		h = ( h ^ p[i] ) * 1099511628211ULL;
+	}
+	return __mix64( h ^ n );
+}
+
+// checksum of an image, 8-byte words at a time
+inline unsigned long long tst_image_hash( const char* p, size_t n )
+{
+	unsigned long long h = 14695981039346656037ULL ^ n;
+	size_t i = 0;
+	for ( ; i + 8 <= n; i += 8 )
+	{
+		unsigned long long w;
+		std::memcpy( &w, p + i, 8 );
+		h = ( h ^ w ) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+	unsigned long long w = 0;
+	std::memcpy( &w, p + i, n - i );
+	return __mix64( h ^ w );
+}
+
+inline unsigned int __popcount64( unsigned long long x )
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return (unsigned int)__builtin_popcountll( x );
+#else
+	x = x - ( ( x >> 1 ) & 0x5555555555555555ULL );
+	x = ( x & 0x3333333333333333ULL ) + ( ( x >> 2 ) & 0x3333333333333333ULL );
+	x = ( x + ( x >> 4 ) ) & 0x0f0f0f0f0f0f0f0fULL;
+	return (unsigned int)( ( x * 0x0101010101010101ULL ) >> 56 );
+#endif
+}
+
+class tst_mph
+{
+public:
+	static const unsigned int npos = (unsigned int)-1;
+
+	struct entry
+	{
+		unsigned long long fingerprint;
+		unsigned int slot;
+		unsigned int reserved;
+	};
+
+public:
+	tst_mph() {}
+
+	// hashes[i] is the key hash of slot i; gamma >= 1 trades space for speed.
+	// false if two keys share a hash
+	bool build( const std::vector<unsigned long long>& hashes, double gamma = 2.0 )
+	{
+		clear();
+		if ( gamma < 1.0 )
+			gamma = 1.0;
+		std::vector<unsigned int> left( hashes.size() );
+		for ( size_t i = 0; i < left.size(); ++i )
+		{
+			left[i] = (unsigned int)i;
+		}
+
+		for ( unsigned int level = 0; !left.empty(); ++level )
+		{
+			if ( level >= __max_levels )
+			{
+				clear();
+				return false; // equal hashes never separate
+			}
+			unsigned long long m = (unsigned long long)( gamma * left.size() ) + 64;
+			m = ( m + 63 ) / 64 * 64;
+			size_t base = words_.size();
+			levels_.push_back( __level( base, m ) );
+			words_.resize( base + m / 64, 0 );
+			std::vector<unsigned long long> coll( m / 64, 0 );
+
+			for ( size_t i = 0; i < left.size(); ++i )
+			{
+				unsigned long long pos = __mix64( hashes[ left[i] ] + level * 0x9e3779b97f4a7c15ULL ) % m;
+				unsigned long long bit = (unsigned long long)1 << ( pos & 63 );
+				unsigned long long& w = words_[ base + pos / 64 ];
+				if ( coll[ pos / 64 ] & bit )
+					continue;
+				if ( w & bit )
+				{
+					w &= ~bit;
+					coll[ pos / 64 ] |= bit;
+				}
+				else
+					w |= bit;
+			}
+
+			std::vector<unsigned int> next;
+			for ( size_t i = 0; i < left.size(); ++i )
+			{
+				unsigned long long pos = __mix64( hashes[ left[i] ] + level * 0x9e3779b97f4a7c15ULL ) % m;
+				if ( coll[ pos / 64 ] & ( (unsigned long long)1 << ( pos & 63 ) ) )
+					next.push_back( left[i] );
+			}
+			left.swap( next );
+		}
+		__rank_index();
+
+		table_.resize( hashes.size() );
+		for ( size_t i = 0; i < hashes.size(); ++i )
+		{
+			entry& e = table_[ __number( hashes[i] ) ];
+			e.fingerprint = hashes[i];
+			e.slot = (unsigned int)i;
+			e.reserved = 0;
+		}
+		return true;
+	}
+
+	unsigned int lookup( unsigned long long h ) const // slot of the key hashing to h, npos if none
+	{
+		unsigned long long k = __number( h );
+		if ( k >= table_.size() || table_[k].fingerprint != h )
+			return npos;
+		return table_[k].slot;
+	}
+
+	void clear()
+	{
+		levels_.clear();
+		words_.clear();
+		ranks_.clear();
+		table_.clear();
+	}
+
+	size_t size() const { return table_.size(); }
+
+	size_t bytes() const // memory held
+	{
+		return words_.size() * 8 + ranks_.size() * sizeof(unsigned int)
+			+ levels_.size() * sizeof(__level) + table_.size() * sizeof(entry);
+	}
+
+	// u64 levels, then per level u64 bits, u64 words, u64 n, entries
+	bool save( std::FILE* f ) const
+	{
+		unsigned long long nl = levels_.size(), nw = words_.size(), n = table_.size();
+		bool ok = std::fwrite( &nl, 8, 1, f ) == 1;
+		for ( size_t i = 0; ok && i < levels_.size(); ++i )
+		{
+			ok = std::fwrite( &levels_[i].bits, 8, 1, f ) == 1;
+		}
+		ok = ok && std::fwrite( &nw, 8, 1, f ) == 1
+			&& ( nw == 0 || std::fwrite( &words_[0], 8, (size_t)nw, f ) == nw )
+			&& std::fwrite( &n, 8, 1, f ) == 1
+			&& ( n == 0 || std::fwrite( &table_[0], sizeof(entry), (size_t)n, f ) == n );
+		return ok;
+	}
+
+	bool load( std::FILE* f )
+	{
+		clear();
+		unsigned long long nl = 0, nw = 0, n = 0, words = 0;
+		if ( std::fread( &nl, 8, 1, f ) != 1 || nl > __max_levels )
+			return false;
+		for ( unsigned long long i = 0; i < nl; ++i )
+		{
+			unsigned long long bits = 0;
+			if ( std::fread( &bits, 8, 1, f ) != 1 || bits % 64 != 0 )
+				return false;
+			levels_.push_back( __level( (size_t)words, bits ) );
+			words += bits / 64;
+		}
+		bool ok = std::fread( &nw, 8, 1, f ) == 1 && nw == words;
+		if ( ok )
+		{
+			words_.resize( (size_t)nw );
+			ok = nw == 0 || std::fread( &words_[0], 8, (size_t)nw, f ) == nw;
+		}
+		ok = ok && std::fread( &n, 8, 1, f ) == 1;
+		if ( ok )
+		{
+			table_.resize( (size_t)n );
+			ok = n == 0 || std::fread( &table_[0], sizeof(entry), (size_t)n, f ) == n;
+		}
+		if ( !ok )
+		{
+			clear();
+			return false;
+		}
+		__rank_index();
+		return true;
+	}
+
+private: // inner use for implement
+	enum { __max_levels = 64 };
+
+	struct __level
+	{
+		__level( size_t b, unsigned long long m ) : base(b), bits(m) {}
+		size_t base; // first word
+		unsigned long long bits;
+	};
+
+	void __rank_index() // set bits before each word
+	{
+		ranks_.resize( words_.size() );
+		unsigned int r = 0;
+		for ( size_t i = 0; i < words_.size(); ++i )
+		{
+			ranks_[i] = r;
+			r += __popcount64( words_[i] );
+		}
+	}
+
+	unsigned long long __number( unsigned long long h ) const // 0..n-1, or n and above if absent
+	{
+		for ( size_t l = 0; l < levels_.size(); ++l )
+		{
+			unsigned long long pos = __mix64( h + l * 0x9e3779b97f4a7c15ULL ) % levels_[l].bits;
+			size_t w = levels_[l].base + (size_t)( pos / 64 );
+			unsigned long long bit = (unsigned long long)1 << ( pos & 63 );
+			if ( words_[w] & bit )
+				return ranks_[w] + __popcount64( words_[w] & ( bit - 1 ) );
+		}
+		return (unsigned long long)-1;
+	}
+
+private:
+	std::vector<__level> levels_;
+	std::vector<unsigned long long> words_;
+	std::vector<unsigned int> ranks_;
+	std::vector<entry> table_; // by number
+};
+
+// a flat map with a tst_mph over its keys; FlatMap is a tst_flat_map
+template<typename FlatMap>
+class tst_hashed_map
+{
+public:
+	typedef typename FlatMap::tstring tstring;
+	typedef typename FlatMap::value_type value_type;
+	typedef typename FlatMap::const_pointer const_pointer;
+	typedef typename FlatMap::index_type index_type;
+	typedef typename tstring::value_type char_type;
+
+public:
+	tst_hashed_map() {}
+
+	// the index is read from path.mph, or built if that is missing or stale
+	bool open( const std::string& path, double gamma = 2.0 )
+	{
+		if ( !flat_.open( path ) )
+			return false;
+		if ( __load( path + ".mph" ) )
+			return true;
+		return build( gamma );
+	}
+
+	void close()
+	{
+		flat_.close();
+		mph_.clear();
+	}
+
+	bool build( double gamma = 2.0 ) // from the keys of the open flat map
+	{
+		std::vector<unsigned long long> hashes;
+		hashes.reserve( flat_.size() );
+		__collect f( hashes );
+		flat_.foreach_ref( f ); // key order is slot order
+		return mph_.build( hashes, gamma );
+	}
+
+	bool save( const std::string& mph_path ) const
+	{
+		std::FILE* f = std::fopen( mph_path.c_str(), "wb" );
+		if ( !f )
+			return false;
+		flat_header h = flat_.header();
+		unsigned long long sum = tst_image_hash( flat_.image(), flat_.image_size() );
+		bool ok = std::fwrite( __mph_magic(), 1, 8, f ) == 8
+			&& std::fwrite( &h, sizeof(h), 1, f ) == 1 // ties the index to its flat file
+			&& std::fwrite( &sum, 8, 1, f ) == 1
+			&& mph_.save( f );
+		return ( std::fclose( f ) == 0 ) && ok;
+	}
+
+	const_pointer find( const tstring& str ) const // raw_column values
+	{
+		unsigned int slot = mph_.lookup( tst_key_hash( str.data(), str.size() ) );
+		return slot == tst_mph::npos ? 0 : flat_.value( (index_type)( slot + 1 ) );
+	}
+
+	bool find( const tstring& str, value_type& val ) const
+	{
+		unsigned int slot = mph_.lookup( tst_key_hash( str.data(), str.size() ) );
+		if ( slot == tst_mph::npos )
+			return false;
+		val = flat_.get( (index_type)( slot + 1 ) );
+		return true;
+	}
+
+	bool find_exact( const tstring& str, value_type& val ) const // confirmed by the tree
+	{
+		return mph_.lookup( tst_key_hash( str.data(), str.size() ) ) != tst_mph::npos
+			&& flat_.find( str, val );
+	}
+
+	size_t size() const { return flat_.size(); }
+
+	const FlatMap& flat() const { return flat_; } // prefix_search, pmsearch, ...
+
+	const tst_mph& index() const { return mph_; }
+
+private: // inner use for implement
+	static const char* __mph_magic() { return "TSTMPH02"; }
+
+	struct __collect
+	{
+		std::vector<unsigned long long>& h_;
+		__collect( std::vector<unsigned long long>& h ) : h_(h) {}
+		void operator()( const tstring& str, const value_type& )
+		{
+			h_.push_back( tst_key_hash( str.data(), str.size() ) );
+		}
+	};
+
+	tst_hashed_map( const tst_hashed_map& );
+	tst_hashed_map& operator = ( const tst_hashed_map& );
+
+	bool __load( const std::string& mph_path )
+	{
+		std::FILE* f = std::fopen( mph_path.c_str(), "rb" );
+		if ( !f )
+			return false;
+		char magic[8];
+		flat_header h;
+		flat_header mine = flat_.header();
+		unsigned long long sum = 0;
+		bool ok = std::fread( magic, 1, 8, f ) == 8 && std::memcmp( magic, __mph_magic(), 8 ) == 0
+			&& std::fread( &h, sizeof(h), 1, f ) == 1 && std::memcmp( &h, &mine, sizeof(h) ) == 0
+			&& std::fread( &sum, 8, 1, f ) == 1 // the header alone misses a rebuilt file of the same shape
+			&& sum == tst_image_hash( flat_.image(), flat_.image_size() )
+			&& mph_.load( f ) && mph_.size() == flat_.size();
+		std::fclose( f );
+		if ( !ok )
+			mph_.clear();
+		return ok;
+	}
+
+private:
+	FlatMap flat_;
+	tst_mph mph_;
+};
+
+// freeze( m, path ) and the index of its keys in path.mph
+template<typename T, typename Ch, typename Comp>
+bool freeze_indexed( const tst_map<T, Ch, Comp>& m, const std::string& path, unsigned int page_size = 0 )
+{
+	tst_hashed_map< tst_flat_map<T, Ch, Comp> > h;
+	return freeze( m, path, page_size ) && h.open( path ) && h.save( path + ".mph" );
+}
+
+} // namespace tst
+
+#endif // TST_MPH_H
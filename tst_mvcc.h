@@ -0,0 +1,449 @@
+/*
+author: suninf
+description: tst_mvcc_map applies batches of inserts and removes atomically:
+			 readers see every key of a batch or none of it. Nodes are never
+			 changed once published; a write copies the path from the root to
+			 the node it touches and shares everything else with the old tree.
+			 A commit publishes the new root with one atomic pointer swap.
+
+			 tst::tst_mvcc_map<int>::transaction t = m.begin();
+			 t.insert( "a", 1 );
+			 t.remove( "b" );
+			 t.commit();                // both at once, or call nothing
+
+			 tst::tst_mvcc_map<int>::version v = m.snapshot(); // pinned
+			 const int* p = v.find( "a" ); // valid while v lives
+
+			 commit is optimistic: if another transaction committed since
+			 begin, the staged operations are replayed on the newer tree and
+			 the swap is tried again, so writers never hold a lock while they
+			 build. try_commit fails instead, for writes that depend on reads.
+			 A version keeps its tree alive; a tree is freed when the last
+			 version and transaction that see it are gone.
+
+			 Needs C++11.
+*/
+
+#ifndef TST_MVCC_H
+#define TST_MVCC_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tst {
+
+template< typename T, typename Ch >
+struct mvcc_tnode
+{
+	typedef std::shared_ptr<const mvcc_tnode> node_ptr;
+	explicit mvcc_tnode( Ch ch ) : splitchar(ch) {}
+
+	Ch splitchar;
+	node_ptr lokid, hikid, eqkid;
+	std::shared_ptr<const T> pdata;
+};
+
+template<typename T, typename Ch = char, typename Comp = std::less<Ch> >
+class tst_mvcc_map
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef mvcc_tnode<T, Ch> node_type;
+	typedef typename node_type::node_ptr node_ptr;
+	typedef tstring key_type;
+	typedef Comp key_compare;
+
+	typedef T value_type;
+	typedef T const& const_reference;
+	typedef T const* const_pointer;
+
+private:
+	struct __state // one published tree
+	{
+		node_ptr root;
+		size_t size;
+		unsigned long long number;
+	};
+	typedef std::shared_ptr<const __state> state_ptr;
+
+	struct __op
+	{
+		bool insert;
+		tstring key;
+		std::shared_ptr<const T> val; // shared by replays
+	};
+
+public:
+	// a read-only view of one committed tree, pinned while the object lives;
+	// a Map for tst_walker and diff (tst_algorithm.h)
+	class version
+	{
+	public:
+		typedef typename tst_mvcc_map::tstring tstring;
+		typedef typename tst_mvcc_map::node_ptr node_ptr;
+		typedef typename tst_mvcc_map::key_compare key_compare;
+		typedef typename tst_mvcc_map::value_type value_type;
+
+	public:
+		version() {}
+
+		const_pointer find( const tstring& str ) const // exist if not return 0
+		{
+			return state_ ? tst_mvcc_map::__find( state_->root, str ) : 0;
+		}
+
+		template< typename Seq >
+		void prefix_search( const tstring& prefix, Seq& c ) const // pair( key, value ), key order
+		{
+			c.clear();
+			if ( !state_ )
+				return;
+			__push_back<Seq> f( c );
+			tstring str( prefix );
+			if ( prefix.empty() )
+			{
+				__travel( state_->root, str, f );
+				return;
+			}
+			const node_type* p = tst_mvcc_map::__find_node( state_->root, prefix );
+			if ( !p )
+				return;
+			if ( p->pdata )
+				f( (const tstring&)str, *p->pdata );
+			__travel( p->eqkid, str, f );
+		}
+
+		template<typename Func>
+		void foreach( Func f ) const // f( const tstring&, const T& ) in key order
+		{
+			tstring str;
+			if ( state_ )
+				__travel( state_->root, str, f );
+		}
+
+		size_t size() const { return state_ ? state_->size : 0; }
+
+		bool empty() const { return size() == 0; }
+
+		unsigned long long number() const { return state_ ? state_->number : 0; } // commits before it
+
+		node_ptr root() const { return state_ ? state_->root : node_ptr(); }
+
+	private:
+		explicit version( const state_ptr& s ) : state_(s) {}
+
+		state_ptr state_;
+
+		friend class tst_mvcc_map;
+	};
+
+	// staged writes against the tree current at begin, visible to its own find
+	class transaction
+	{
+	public:
+		transaction( transaction&& t ) = default;
+		transaction& operator = ( transaction&& t ) = default;
+
+		void insert( const tstring& str, const T& val )
+		{
+			if ( str.empty() ) // ignore empty string
+				return;
+			__op op = { true, str, std::make_shared<const T>( val ) };
+			tst_mvcc_map::__apply( root_, size_, op );
+			log_.push_back( std::move( op ) );
+		}
+
+		bool remove( const tstring& str ) // false if absent at this point of the transaction
+		{
+			__op op = { false, str, std::shared_ptr<const T>() };
+			if ( !tst_mvcc_map::__apply( root_, size_, op ) )
+				return false;
+			log_.push_back( std::move( op ) );
+			return true;
+		}
+
+		const_pointer find( const tstring& str ) const { return tst_mvcc_map::__find( root_, str ); }
+
+		size_t size() const { return size_; }
+
+		// publish every staged write at once, replayed over newer commits as
+		// blind writes; returns the number of the new version. The
+		// transaction then goes on from that version
+		unsigned long long commit()
+		{
+			if ( log_.empty() )
+				return base_->number;
+			while ( true )
+			{
+				std::shared_ptr<__state> next = std::make_shared<__state>();
+				next->root = root_;
+				next->size = size_;
+				next->number = base_->number + 1;
+				state_ptr expected = base_;
+				if ( map_->__cas( expected, next ) )
+				{
+					base_ = next;
+					log_.clear();
+					return next->number;
+				}
+				base_ = expected; // someone committed first: redo on top of theirs
+				root_ = base_->root;
+				size_ = base_->size;
+				for ( size_t i = 0; i < log_.size(); ++i )
+				{
+					tst_mvcc_map::__apply( root_, size_, log_[i] );
+				}
+			}
+		}
+
+		// publish only if nothing was committed since begin, the check for
+		// writes computed from what the transaction read; on false nothing
+		// changed, rollback and redo
+		bool try_commit()
+		{
+			if ( log_.empty() )
+				return true;
+			std::shared_ptr<__state> next = std::make_shared<__state>();
+			next->root = root_;
+			next->size = size_;
+			next->number = base_->number + 1;
+			state_ptr expected = base_;
+			if ( !map_->__cas( expected, next ) )
+				return false;
+			base_ = next;
+			log_.clear();
+			return true;
+		}
+
+		void rollback() // drop the staged writes and go on from the latest version
+		{
+			base_ = map_->__load();
+			root_ = base_->root;
+			size_ = base_->size;
+			log_.clear();
+		}
+
+		unsigned long long number() const { return base_->number; } // the version begun from
+
+		size_t staged() const { return log_.size(); }
+
+	private:
+		explicit transaction( tst_mvcc_map* m )
+			: map_(m), base_( m->__load() ), root_( base_->root ), size_( base_->size ) {}
+
+		tst_mvcc_map* map_;
+		state_ptr base_;
+		node_ptr root_;
+		size_t size_;
+		std::vector<__op> log_;
+
+		friend class tst_mvcc_map;
+	};
+
+public:
+	tst_mvcc_map()
+	{
+		std::shared_ptr<__state> s = std::make_shared<__state>();
+		s->size = 0;
+		s->number = 0;
+		__store( s );
+	}
+
+	tst_mvcc_map( const tst_mvcc_map& ) = delete;
+	tst_mvcc_map& operator = ( const tst_mvcc_map& ) = delete;
+
+	transaction begin() { return transaction( this ); }
+
+	version snapshot() const { return version( __load() ); }
+
+	// one-write transactions
+	void insert( const tstring& str, const T& val )
+	{
+		transaction t( this );
+		t.insert( str, val );
+		t.commit();
+	}
+
+	bool remove( const tstring& str )
+	{
+		transaction t( this );
+		bool removed = t.remove( str );
+		t.commit();
+		return removed;
+	}
+
+	bool find( const tstring& str, T& val ) const // by copy, from the current version
+	{
+		state_ptr s = __load();
+		const_pointer p = __find( s->root, str );
+		if ( p )
+			val = *p;
+		return p != 0;
+	}
+
+	size_t size() const { return __load()->size; }
+
+	bool empty() const { return size() == 0; }
+
+private: // inner use for implement
+#if __cplusplus > 201703L && defined(__cpp_lib_atomic_shared_ptr)
+	state_ptr __load() const { return current_.load(); }
+	void __store( const state_ptr& s ) { current_.store( s ); }
+	bool __cas( state_ptr& expected, const state_ptr& s ) { return current_.compare_exchange_strong( expected, s ); }
+
+	std::atomic<state_ptr> current_;
+#else
+	state_ptr __load() const { return std::atomic_load( &current_ ); }
+	void __store( const state_ptr& s ) { std::atomic_store( &current_, s ); }
+	bool __cas( state_ptr& expected, const state_ptr& s )
+	{
+		return std::atomic_compare_exchange_strong( &current_, &expected, s );
+	}
+
+	state_ptr current_;
+#endif
+
+	// applies op to the tree at root by path copying; false if a remove found nothing
+	static bool __apply( node_ptr& root, size_t& size, const __op& op )
+	{
+		if ( op.insert )
+		{
+			bool added = false;
+			root = __insert( root, op.key.data(), op.key.data() + op.key.size(), op.val, added );
+			size += added ? 1 : 0;
+			return true;
+		}
+		if ( !__find( root, op.key ) )
+			return false;
+		root = __remove( root, op.key.data(), op.key.data() + op.key.size() );
+		--size;
+		return true;
+	}
+
+	static const node_type* __find_node( const node_ptr& root, const tstring& str )
+	{
+		Comp comp;
+		const node_type* p = root.get();
+		const Ch* s = str.data();
+		const Ch* e = s + str.size();
+		if ( s == e )
+			return 0;
+		while ( p )
+		{
+			if ( comp( *s, p->splitchar ) )
+				p = p->lokid.get();
+			else if ( comp( p->splitchar, *s ) )
+				p = p->hikid.get();
+			else
+			{
+				if ( ++s == e )
+					return p;
+				p = p->eqkid.get();
+			}
+		}
+		return 0;
+	}
+
+	static const_pointer __find( const node_ptr& root, const tstring& str )
+	{
+		const node_type* p = __find_node( root, str );
+		return p ? p->pdata.get() : 0;
+	}
+
+	static node_ptr __insert( const node_ptr& p, const Ch* s, const Ch* e,
+		const std::shared_ptr<const T>& val, bool& added )
+	{
+		Comp comp;
+		std::shared_ptr<node_type> q = p ? std::make_shared<node_type>( *p )
+			: std::make_shared<node_type>( *s );
+		if ( comp( *s, q->splitchar ) )
+			q->lokid = __insert( q->lokid, s, e, val, added );
+		else if ( comp( q->splitchar, *s ) )
+			q->hikid = __insert( q->hikid, s, e, val, added );
+		else if ( s + 1 == e )
+		{
+			added = !q->pdata;
+			q->pdata = val;
+		}
+		else
+			q->eqkid = __insert( q->eqkid, s + 1, e, val, added );
+		return q;
+	}
+
+	static node_ptr __remove( const node_ptr& p, const Ch* s, const Ch* e ) // the key is present
+	{
+		Comp comp;
+		std::shared_ptr<node_type> q = std::make_shared<node_type>( *p );
+		if ( comp( *s, q->splitchar ) )
+			q->lokid = __remove( q->lokid, s, e );
+		else if ( comp( q->splitchar, *s ) )
+			q->hikid = __remove( q->hikid, s, e );
+		else if ( s + 1 == e )
+			q->pdata.reset();
+		else
+			q->eqkid = __remove( q->eqkid, s + 1, e );
+
+		if ( q->pdata || q->eqkid )
+			return q;
+		return __join( q->lokid, q->hikid ); // q leads to no key any more
+	}
+
+	static node_ptr __join( const node_ptr& lo, const node_ptr& hi ) // one BST level from two
+	{
+		if ( !lo )
+			return hi;
+		if ( !hi )
+			return lo;
+		node_ptr max;
+		node_ptr rest = __remove_max( lo, max );
+		std::shared_ptr<node_type> r = std::make_shared<node_type>( *max );
+		r->lokid = rest;
+		r->hikid = hi;
+		return r;
+	}
+
+	static node_ptr __remove_max( const node_ptr& p, node_ptr& max )
+	{
+		if ( !p->hikid )
+		{
+			max = p;
+			return p->lokid;
+		}
+		std::shared_ptr<node_type> q = std::make_shared<node_type>( *p );
+		q->hikid = __remove_max( p->hikid, max );
+		return q;
+	}
+
+	template< typename Func >
+	static void __travel( const node_ptr& p, tstring& cur_str, Func& f )
+	{
+		if ( !p )
+			return;
+		__travel( p->lokid, cur_str, f );
+		cur_str.push_back( p->splitchar );
+		if ( p->pdata )
+			f( (const tstring&)cur_str, *p->pdata );
+		__travel( p->eqkid, cur_str, f );
+		cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		__travel( p->hikid, cur_str, f );
+	}
+
+	template< typename Seq >
+	struct __push_back
+	{
+		Seq& c_;
+		__push_back( Seq& c ) : c_(c) {}
+		void operator()( const tstring& str, const T& t )
+		{
+			c_.push_back( std::make_pair( str, t ) );
+		}
+	};
+};
+
+} // namespace tst
+
+#endif // TST_MVCC_H
@@ -0,0 +1,322 @@
+/*
+author: suninf
+description: tst_replicated_map serves a read-mostly map from one frozen copy
+			 per NUMA node, so readers on every socket search memory of their
+			 own node instead of all hammering the node that allocated the
+			 tree. Writes go to a primary tst_map; publish() freezes it in the
+			 flat format (tst_flat.h) and copies the image onto each node,
+			 from a thread pinned there, so first touch places the pages on
+			 that node. Readers then switch to the new copies atomically.
+
+			 find( key, val ) searches the replica of the calling thread's
+			 node; local() hands out that replica for a run of lookups.
+
+			 numa_topology reads the nodes and their cpus from
+			 /sys/devices/system/node on Linux; elsewhere, or when that is
+			 missing, there is one node and nothing is pinned. T must be
+			 trivially copyable. Needs C++11 threads.
+*/
+
+#ifndef TST_NUMA_H
+#define TST_NUMA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "tst_map.h"
+#include "tst_flat.h"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace tst {
+
+class numa_topology
+{
+public:
+	numa_topology() : cpus_( 1 ) {} // one node, no cpu list
+
+	// nodes without cpu lists: replicas on one box, all readers on node 0
+	explicit numa_topology( size_t nodes ) : cpus_( nodes ? nodes : 1 ) {}
+
+	static numa_topology detect()
+	{
+		numa_topology t;
+#ifdef __linux__
+		std::vector<int> ids;
+		if ( DIR* d = opendir( "/sys/devices/system/node" ) )
+		{
+			while ( dirent* e = readdir( d ) )
+			{
+				int id;
+				char rest;
+				if ( std::sscanf( e->d_name, "node%d%c", &id, &rest ) == 1 )
+					ids.push_back( id );
+			}
+			closedir( d );
+		}
+		std::sort( ids.begin(), ids.end() );
+		std::vector< std::vector<int> > cpus;
+		for ( size_t i = 0; i < ids.size(); ++i )
+		{
+			char path[96];
+			std::snprintf( path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", ids[i] );
+			std::vector<int> list;
+			if ( __read_cpulist( path, list ) && !list.empty() ) // memory-only nodes serve no reader
+				cpus.push_back( list );
+		}
+		if ( !cpus.empty() )
+		{
+			t.cpus_.swap( cpus );
+			for ( size_t n = 0; n < t.cpus_.size(); ++n )
+			{
+				for ( size_t i = 0; i < t.cpus_[n].size(); ++i )
+				{
+					size_t c = (size_t)t.cpus_[n][i];
+					if ( t.node_of_.size() <= c )
+						t.node_of_.resize( c + 1, 0 );
+					t.node_of_[c] = n;
+				}
+			}
+		}
+#endif
+		return t;
+	}
+
+	size_t nodes() const { return cpus_.size(); }
+
+	const std::vector<int>& cpus( size_t node ) const { return cpus_[node]; } // empty: any cpu
+
+	size_t node_of_cpu( int cpu ) const // 0 if unknown
+	{
+		return cpu >= 0 && (size_t)cpu < node_of_.size() ? node_of_[cpu] : 0;
+	}
+
+	size_t current_node() const // of the cpu running the caller
+	{
+#ifdef __linux__
+		return nodes() > 1 ? node_of_cpu( sched_getcpu() ) : 0;
+#else
+		return 0;
+#endif
+	}
+
+	bool pin( size_t node ) const // the calling thread to the cpus of node
+	{
+#ifdef __linux__
+		if ( node >= nodes() || cpus_[node].empty() )
+			return false;
+		cpu_set_t set;
+		CPU_ZERO( &set );
+		for ( size_t i = 0; i < cpus_[node].size(); ++i )
+		{
+			if ( cpus_[node][i] < CPU_SETSIZE )
+				CPU_SET( cpus_[node][i], &set );
+		}
+		return pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0;
+#else
+		(void)node;
+		return false;
+#endif
+	}
+
+private: // inner use for implement
+	static bool __read_cpulist( const char* path, std::vector<int>& list ) // "0-3,8-11"
+	{
+		std::FILE* f = std::fopen( path, "r" );
+		if ( !f )
+			return false;
+		int lo, hi;
+		while ( std::fscanf( f, "%d", &lo ) == 1 )
+		{
+			hi = lo;
+			int c = std::fgetc( f );
+			if ( c == '-' )
+			{
+				if ( std::fscanf( f, "%d", &hi ) != 1 )
+					break;
+				c = std::fgetc( f );
+			}
+			for ( int i = lo; i <= hi; ++i )
+			{
+				list.push_back( i );
+			}
+			if ( c != ',' )
+				break;
+		}
+		std::fclose( f );
+		return true;
+	}
+
+private:
+	std::vector< std::vector<int> > cpus_; // by node
+	std::vector<size_t> node_of_; // by cpu
+};
+
+template<typename T, typename Ch = char, typename Comp = std::less<Ch> >
+class tst_replicated_map
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef tst_map<T, Ch, Comp> primary_type;
+	typedef tst_flat_map<T, Ch, Comp> replica_type;
+	typedef std::shared_ptr<const replica_type> replica_ptr;
+	typedef tstring key_type;
+	typedef T value_type;
+
+public:
+	// scratch_path: where publish writes the flat image on its way to the replicas
+	explicit tst_replicated_map( const std::string& scratch_path,
+		const numa_topology& topo = numa_topology::detect() )
+		: scratch_(scratch_path), topo_(topo), slots_( topo.nodes() ), published_(0) {}
+
+	tst_replicated_map( const tst_replicated_map& ) = delete;
+	tst_replicated_map& operator = ( const tst_replicated_map& ) = delete;
+
+	// writes, seen by readers after the next publish
+	void insert( const tstring& str, const T& val )
+	{
+		std::lock_guard<std::mutex> lock( write_ );
+		primary_.insert( str, val );
+	}
+
+	bool remove( const tstring& str )
+	{
+		std::lock_guard<std::mutex> lock( write_ );
+		return primary_.remove( str );
+	}
+
+	template<typename Func>
+	void update( Func f ) // f( primary_type& ), for batches and merges
+	{
+		std::lock_guard<std::mutex> lock( write_ );
+		f( primary_ );
+	}
+
+	// freezes the primary and replaces the copy on every node; false on an I/O error
+	bool publish()
+	{
+		std::lock_guard<std::mutex> lock( write_ );
+		std::vector<char> image;
+		bool ok = freeze( primary_, scratch_ ) && __read_file( scratch_, image );
+		std::remove( scratch_.c_str() );
+		if ( !ok )
+			return false;
+
+		std::vector< std::shared_ptr<__replica> > fresh( topo_.nodes() );
+		std::vector<std::thread> builders;
+		for ( size_t n = 0; n < fresh.size(); ++n )
+		{
+			builders.push_back( std::thread( [this, n, &image, &fresh]() {
+				topo_.pin( n ); // first touch from node n puts the pages there
+				std::shared_ptr<__replica> r = std::make_shared<__replica>();
+				r->words.reset( new unsigned long long[ ( image.size() + 7 ) / 8 ] ); // 8-byte aligned
+				std::memcpy( r->words.get(), &image[0], image.size() );
+				if ( r->map.open_memory( r->words.get(), image.size() ) )
+					fresh[n] = r;
+			} ) );
+		}
+		for ( size_t n = 0; n < builders.size(); ++n )
+		{
+			builders[n].join();
+		}
+		for ( size_t n = 0; n < fresh.size(); ++n )
+		{
+			if ( !fresh[n] )
+				return false;
+		}
+		for ( size_t n = 0; n < fresh.size(); ++n )
+		{
+			__store( slots_[n], replica_ptr( fresh[n], &fresh[n]->map ) );
+		}
+		++published_;
+		return true;
+	}
+
+	replica_ptr replica( size_t node ) const // 0 before the first publish
+	{
+		return __load( slots_[ node < slots_.size() ? node : 0 ] );
+	}
+
+	replica_ptr local() const { return replica( topo_.current_node() ); }
+
+	bool find( const tstring& str, T& val ) const // in the local replica
+	{
+		replica_ptr r = local();
+		return r && r->find( str, val );
+	}
+
+	size_t size() const // keys published
+	{
+		replica_ptr r = replica( 0 );
+		return r ? r->size() : 0;
+	}
+
+	size_t publishes() const { return published_; }
+
+	const numa_topology& topology() const { return topo_; }
+
+private: // inner use for implement
+	struct __replica
+	{
+		std::unique_ptr<unsigned long long[]> words; // the image, on the node that built it
+		replica_type map; // over words, closed first
+	};
+
+#if __cplusplus > 201703L && defined(__cpp_lib_atomic_shared_ptr)
+	struct __slot // padded, readers of different nodes share no cache line
+	{
+		std::atomic<replica_ptr> current;
+		char pad[64];
+	};
+
+	static replica_ptr __load( const __slot& s ) { return s.current.load(); }
+	static void __store( __slot& s, const replica_ptr& r ) { s.current.store( r ); }
+#else
+	struct __slot // padded, readers of different nodes share no cache line
+	{
+		replica_ptr current;
+		char pad[64];
+	};
+
+	static replica_ptr __load( const __slot& s ) { return std::atomic_load( &s.current ); }
+	static void __store( __slot& s, const replica_ptr& r ) { std::atomic_store( &s.current, r ); }
+#endif
+
+	static bool __read_file( const std::string& path, std::vector<char>& buf )
+	{
+		std::FILE* f = std::fopen( path.c_str(), "rb" );
+		if ( !f )
+			return false;
+		char tmp[1 << 16];
+		size_t n;
+		while ( (n = std::fread( tmp, 1, sizeof(tmp), f )) > 0 )
+		{
+			buf.insert( buf.end(), tmp, tmp + n );
+		}
+		bool ok = !std::ferror( f );
+		std::fclose( f );
+		return ok && !buf.empty();
+	}
+
+private:
+	std::string scratch_;
+	numa_topology topo_;
+	std::mutex write_; // the primary and publish
+	primary_type primary_;
+	std::vector<__slot> slots_; // by node
+	std::atomic<size_t> published_;
+};
+
+} // namespace tst
+
+#endif // TST_NUMA_H
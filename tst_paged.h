@@ -0,0 +1,416 @@
+/*
+author: suninf
+description: tst_paged_map searches a flat file (tst_flat.h) that stays on
+			 disk. The file is read in pages through a fixed-size buffer pool
+			 with CLOCK replacement, so a dictionary far bigger than memory
+			 costs only the pool. The flat writer stores every subtree as one
+			 run of the node array, so the deeper part of a descent stays
+			 within a page or two, and the pages near the root stay in the
+			 pool.
+
+			 the file must be written with a page size, e.g.
+			 freeze( m, path, 4096 ) or tst_external_builder( path, budget, 16384 ).
+			 Values are returned by copy, a pool page may be reused at any
+			 time; the value column must be raw_column.
+			 Not thread-safe; give each thread its own tst_paged_map.
+*/
+
+#ifndef TST_PAGED_H
+#define TST_PAGED_H
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "tst_flat.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace tst {
+
+// fixed number of page frames over one file
+class tst_buffer_pool
+{
+public:
+	tst_buffer_pool() : fd_(-1), page_size_(0), hand_(0), last_page_(-1), last_frame_(0),
+		hits_(0), misses_(0) {}
+
+	~tst_buffer_pool()
+	{
+		close();
+	}
+
+	bool open( const std::string& path, size_t page_size, size_t frames )
+	{
+		close();
+#ifdef _WIN32
+		fd_ = _open( path.c_str(), _O_RDONLY | _O_BINARY );
+#else
+		fd_ = ::open( path.c_str(), O_RDONLY );
+#endif
+		if ( fd_ < 0 || page_size == 0 )
+			return false;
+		page_size_ = page_size;
+		frames = frames ? frames : 1;
+		data_.assign( frames * page_size, 0 );
+		page_.assign( frames, (unsigned long long)-1 );
+		ref_.assign( frames, false );
+		return true;
+	}
+
+	void close()
+	{
+		if ( fd_ >= 0 )
+		{
+#ifdef _WIN32
+			_close( fd_ );
+#else
+			::close( fd_ );
+#endif
+		}
+		fd_ = -1;
+		data_.clear();
+		page_.clear();
+		ref_.clear();
+		table_.clear();
+		hand_ = 0;
+		last_page_ = (unsigned long long)-1;
+	}
+
+	// page p of the file, valid until the next call; 0 on a read error
+	const char* page( unsigned long long p )
+	{
+		if ( p == last_page_ )
+		{
+			++hits_;
+			return &data_[ last_frame_ * page_size_ ];
+		}
+		std::map<unsigned long long, size_t>::iterator it = table_.find( p );
+		size_t f;
+		if ( it != table_.end() )
+		{
+			++hits_;
+			f = it->second;
+		}
+		else
+		{
+			++misses_;
+			f = __victim();
+			if ( page_[f] != (unsigned long long)-1 )
+				table_.erase( page_[f] );
+			page_[f] = (unsigned long long)-1;
+			if ( !__read_at( p * page_size_, &data_[ f * page_size_ ], page_size_, true ) )
+			{
+				last_page_ = (unsigned long long)-1;
+				return 0;
+			}
+			page_[f] = p;
+			table_[p] = f;
+		}
+		ref_[f] = true;
+		last_page_ = p;
+		last_frame_ = f;
+		return &data_[ f * page_size_ ];
+	}
+
+	// n bytes at off, straight from the file
+	bool read( unsigned long long off, void* buf, size_t n ) { return __read_at( off, buf, n, false ); }
+
+	size_t page_size() const { return page_size_; }
+
+	size_t hits() const { return hits_; }
+
+	size_t misses() const { return misses_; }
+
+private: // inner use for implement
+	size_t __victim() // CLOCK: the first frame not used since the hand last passed
+	{
+		while ( true )
+		{
+			size_t f = hand_;
+			hand_ = ( hand_ + 1 ) % page_.size();
+			if ( !ref_[f] )
+				return f;
+			ref_[f] = false;
+		}
+	}
+
+	bool __read_at( unsigned long long off, void* buf, size_t n, bool short_ok )
+	{
+		char* p = (char*)buf;
+		while ( n > 0 )
+		{
+#ifdef _WIN32
+			if ( _lseeki64( fd_, (__int64)off, SEEK_SET ) < 0 )
+				return false;
+			int r = _read( fd_, p, (unsigned)n );
+#else
+			ssize_t r = pread( fd_, p, n, (off_t)off );
+#endif
+			if ( r < 0 )
+				return false;
+			if ( r == 0 ) // the last page of the file is short
+			{
+				if ( !short_ok )
+					return false;
+				std::memset( p, 0, n );
+				return true;
+			}
+			p += r;
+			off += r;
+			n -= r;
+		}
+		return true;
+	}
+
+	tst_buffer_pool( const tst_buffer_pool& );
+	tst_buffer_pool& operator = ( const tst_buffer_pool& );
+
+private:
+	int fd_;
+	size_t page_size_;
+	std::vector<char> data_;
+	std::vector<unsigned long long> page_; // page held by each frame, -1 none
+	std::vector<bool> ref_;
+	std::map<unsigned long long, size_t> table_;
+	size_t hand_;
+	unsigned long long last_page_;
+	size_t last_frame_;
+	size_t hits_, misses_;
+};
+
+template<typename T, typename Ch = char, typename Comp = std::less<Ch>,
+	typename Index = unsigned int>
+class tst_paged_map
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef flat_node<Ch, Index> node_type;
+	typedef tstring key_type;
+	typedef Comp key_compare;
+
+	typedef T value_type;
+
+public:
+	tst_paged_map() : open_(false) {}
+
+	// pool_bytes of page frames; the page size is the file's
+	bool open( const std::string& path, size_t pool_bytes = 64 << 20 )
+	{
+		close();
+		flat_header h;
+		if ( !pool_.open( path, sizeof(flat_header), 1 ) || !pool_.read( 0, &h, sizeof(h) ) )
+			return false;
+		if ( std::memcmp( h.magic, __flat_magic(), 8 ) != 0 || h.char_size != sizeof(Ch)
+			|| h.index_size != sizeof(Index) || h.value_size != sizeof(T) || h.nodes == 0
+			|| h.page_size < sizeof(node_type) || h.nodes_offset % h.page_size != 0
+			|| h.column != column_raw )
+		{
+			pool_.close();
+			return false;
+		}
+		h_ = h;
+		per_page_ = h_.page_size / sizeof(node_type);
+		open_ = pool_.open( path, h_.page_size, pool_bytes / h_.page_size );
+		return open_;
+	}
+
+	void close()
+	{
+		pool_.close();
+		open_ = false;
+	}
+
+	bool is_open() const { return open_; }
+
+	bool find( const tstring& str, T& val ) // false if absent or on a read error
+	{
+		return find_n( str.data(), str.size(), val );
+	}
+
+	bool find_n( const Ch* s, size_t n, T& val ) // key [s, s+n)
+	{
+		node_type p;
+		return __descend( s, n, p ) && p.value && __value( p.value, val );
+	}
+
+	bool has_prefix( const tstring& prefix ) // some key starts with prefix
+	{
+		node_type p;
+		if ( prefix.empty() )
+			return size() > 0;
+		return __descend( prefix.data(), prefix.size(), p ) && ( p.value || p.eqkid );
+	}
+
+	// pair( key, value ) of every key starting with prefix, in key order
+	template< typename Seq >
+	void prefix_search( const tstring& prefix, Seq& c )
+	{
+		c.clear();
+		if ( !open_ )
+			return;
+		__push_back<Seq> f(c);
+		tstring str( prefix );
+		if ( prefix.empty() )
+		{
+			__walk( (Index)h_.root, str, f );
+			return;
+		}
+		node_type p;
+		if ( !__descend( prefix.data(), prefix.size(), p ) )
+			return;
+		T val;
+		if ( p.value && __value( p.value, val ) )
+			c.push_back( std::make_pair( str, val ) );
+		__walk( p.eqkid, str, f );
+	}
+
+	template< typename Seq >
+	void pmsearch( const tstring& str, Seq& c ) // '.' matches any character
+	{
+		tstring strtmp;
+		c.clear();
+		if ( open_ )
+			__pmsearch( (Index)h_.root, str.c_str(), strtmp, c );
+	}
+
+	template<typename Func>
+	void foreach( Func f ) // f( const tstring&, const T& ) in key order
+	{
+		tstring str;
+		if ( open_ )
+			__walk( (Index)h_.root, str, f );
+	}
+
+	size_t size() const { return open_ ? (size_t)h_.values : 0; }
+
+	bool empty() const { return size() == 0; }
+
+	const tst_buffer_pool& pool() const { return pool_; }
+
+private: // inner use for implement
+	bool __node( Index i, node_type& n )
+	{
+		const char* pg = pool_.page( h_.nodes_offset / h_.page_size + i / per_page_ );
+		if ( !pg )
+			return false;
+		std::memcpy( &n, pg + ( i % per_page_ ) * sizeof(node_type), sizeof(n) );
+		return true;
+	}
+
+	bool __value( Index slot, T& val )
+	{
+		unsigned long long off = h_.values_offset + (unsigned long long)( slot - 1 ) * sizeof(T);
+		unsigned long long first = off / h_.page_size;
+		size_t in = (size_t)( off % h_.page_size );
+		if ( in + sizeof(T) <= h_.page_size )
+		{
+			const char* pg = pool_.page( first );
+			if ( !pg )
+				return false;
+			std::memcpy( &val, pg + in, sizeof(T) );
+			return true;
+		}
+		return pool_.read( off, &val, sizeof(T) ); // across two pages
+	}
+
+	bool __descend( const Ch* s, size_t n, node_type& p ) // p: the node of the last character
+	{
+		if ( !open_ || n == 0 )
+			return false;
+		const Ch* e = s + n;
+		Index i = (Index)h_.root;
+		while ( i && __node( i, p ) )
+		{
+			if ( comp_( *s, p.splitchar ) )
+				i = p.lokid;
+			else if ( comp_( p.splitchar, *s ) )
+				i = p.hikid;
+			else
+			{
+				if ( ++s == e )
+					return true;
+				i = p.eqkid;
+			}
+		}
+		return false;
+	}
+
+	template< typename Func >
+	void __walk( Index i, tstring& cur_str, Func& f )
+	{
+		node_type p;
+		if ( !i || !__node( i, p ) )
+			return;
+		__walk( p.lokid, cur_str, f );
+		cur_str.push_back( p.splitchar );
+		T val;
+		if ( p.value && __value( p.value, val ) )
+			f( (const tstring&)cur_str, (const T&)val );
+		__walk( p.eqkid, cur_str, f );
+		cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		__walk( p.hikid, cur_str, f );
+	}
+
+	template< typename Seq >
+	void __pmsearch( Index i, const Ch* s, tstring& cur_str, Seq& c )
+	{
+		node_type p;
+		if ( *s == 0 || !i || !__node( i, p ) )
+			return;
+		if ( *s=='.' || comp_(*s, p.splitchar) )
+		{
+			__pmsearch( p.lokid, s, cur_str, c );
+		}
+		if ( *s=='.' || ( !comp_(*s, p.splitchar) && !comp_( p.splitchar, *s ) ) )
+		{
+			cur_str.push_back( p.splitchar );
+			T val;
+			if ( *(s+1) == 0 && p.value && __value( p.value, val ) )
+			{
+				c.push_back( std::make_pair( cur_str, val ) );
+			}
+			else if ( *(s+1) )
+			{
+				__pmsearch( p.eqkid, s+1, cur_str, c );
+			}
+			cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		}
+		if ( *s=='.' || comp_( p.splitchar, *s ) )
+		{
+			__pmsearch( p.hikid, s, cur_str, c );
+		}
+	}
+
+	template< typename Seq >
+	struct __push_back
+	{
+		Seq& c_;
+		__push_back( Seq& c ) : c_(c) {}
+		void operator()( const tstring& str, const T& t )
+		{
+			c_.push_back( std::make_pair( str, t ) );
+		}
+	};
+
+	tst_paged_map( const tst_paged_map& );
+	tst_paged_map& operator = ( const tst_paged_map& );
+
+private:
+	tst_buffer_pool pool_;
+	flat_header h_;
+	size_t per_page_;
+	bool open_;
+	Comp comp_;
+};
+
+} // namespace tst
+
+#endif // TST_PAGED_H
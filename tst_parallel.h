@@ -0,0 +1,231 @@
+/*
+author: suninf
+description: build_parallel( m, beg, end, threads ) builds a tst_map from
+			 unsorted pairs on several threads. The input is sorted in
+			 parallel, the upper levels of the tree are laid out from the
+			 sorted keys, and the subtrees below them are built
+			 independently, each level a balanced BST. Large first-character
+			 groups are split at deeper levels until the pieces are small
+			 enough to share out. Needs C++11 threads.
+*/
+
+#ifndef TST_PARALLEL_H
+#define TST_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <thread>
+#include <vector>
+#include "tst_map.h"
+
+namespace tst {
+
+template<typename Map, typename Pair>
+class __parallel_builder
+{
+public:
+	typedef typename Map::node_type node_type;
+	typedef typename Map::node_ptr node_ptr;
+	typedef typename Map::value_type T;
+	typedef const Pair* item;
+
+	__parallel_builder( std::vector<item>& v ) : v_(v) {}
+
+	struct key_less
+	{
+		bool operator()( item a, item b ) const
+		{
+			typename Map::key_compare comp;
+			return std::lexicographical_compare( a->first.begin(), a->first.end(),
+				b->first.begin(), b->first.end(), comp );
+		}
+	};
+
+	static bool key_equal( item a, item b )
+	{
+		return !key_less()( a, b ) && !key_less()( b, a );
+	}
+
+	// stable sort of v on threads, equal keys stay in input order
+	static void sort( std::vector<item>& v, unsigned threads )
+	{
+		size_t n = v.size();
+		std::vector<size_t> bounds;
+		for ( unsigned t = 0; t <= threads; ++t )
+		{
+			bounds.push_back( n * t / threads );
+		}
+		std::vector<std::thread> ts;
+		for ( unsigned t = 0; t < threads; ++t )
+		{
+			ts.push_back( std::thread( [&v, &bounds, t]() {
+				std::stable_sort( v.begin() + bounds[t], v.begin() + bounds[t+1], key_less() );
+			} ) );
+		}
+		__join( ts );
+
+		while ( bounds.size() > 2 ) // merge neighbouring runs pairwise, in parallel
+		{
+			std::vector<size_t> next;
+			for ( size_t i = 0; i + 2 < bounds.size(); i += 2 )
+			{
+				size_t lo = bounds[i], mid = bounds[i+1], hi = bounds[i+2];
+				ts.push_back( std::thread( [&v, lo, mid, hi]() {
+					std::inplace_merge( v.begin() + lo, v.begin() + mid, v.begin() + hi, key_less() );
+				} ) );
+				next.push_back( lo );
+			}
+			if ( bounds.size() % 2 == 0 ) // odd run count, the last run waits
+				next.push_back( bounds[bounds.size()-2] );
+			next.push_back( n );
+			__join( ts );
+			bounds.swap( next );
+		}
+	}
+
+	// keys [lo, hi) share their first d characters; the level at depth d.
+	// eq subtrees of at most grain keys are left to run_jobs, 0 builds all
+	node_ptr level( size_t lo, size_t hi, size_t d, size_t grain )
+	{
+		std::vector<node_ptr> nodes;
+		typename Map::key_compare comp;
+		while ( lo < hi )
+		{
+			typename Map::tstring::value_type ch = v_[lo]->first[d];
+			size_t end = lo + 1;
+			while ( end < hi && !comp( ch, v_[end]->first[d] ) )
+				++end;
+
+			node_ptr p = new node_type( ch );
+			size_t rest = lo;
+			if ( v_[lo]->first.size() == d + 1 )
+			{
+				p->pdata = new T( v_[lo]->second );
+				++rest;
+			}
+			if ( rest < end )
+			{
+				if ( end - rest <= grain )
+					jobs_.push_back( __job( &p->eqkid, rest, end, d + 1 ) );
+				else
+					p->eqkid = level( rest, end, d + 1, grain );
+			}
+			nodes.push_back( p );
+			lo = end;
+		}
+		return __balance( nodes, 0, nodes.size() );
+	}
+
+	void run_jobs( unsigned threads )
+	{
+		std::vector<size_t> order( jobs_.size() );
+		for ( size_t i = 0; i < order.size(); ++i )
+		{
+			order[i] = i;
+		}
+		std::sort( order.begin(), order.end(), __bigger(jobs_) ); // largest first
+
+		std::atomic<size_t> next( 0 );
+		std::vector<std::thread> ts;
+		for ( unsigned t = 0; t < threads; ++t )
+		{
+			ts.push_back( std::thread( [this, &order, &next]() {
+				size_t i;
+				while ( (i = next++) < order.size() )
+				{
+					__job& j = jobs_[ order[i] ];
+					*j.slot = level( j.lo, j.hi, j.d, 0 );
+				}
+			} ) );
+		}
+		__join( ts );
+	}
+
+private: // inner use for implement
+	struct __job
+	{
+		__job( node_ptr* s, size_t l, size_t h, size_t dd ) : slot(s), lo(l), hi(h), d(dd) {}
+		node_ptr* slot; // the eqkid to fill
+		size_t lo, hi, d;
+	};
+
+	struct __bigger
+	{
+		const std::vector<__job>& jobs_;
+		__bigger( const std::vector<__job>& j ) : jobs_(j) {}
+		bool operator()( size_t a, size_t b ) const
+		{
+			return jobs_[a].hi - jobs_[a].lo > jobs_[b].hi - jobs_[b].lo;
+		}
+	};
+
+	static void __join( std::vector<std::thread>& ts )
+	{
+		for ( size_t i = 0; i < ts.size(); ++i )
+		{
+			ts[i].join();
+		}
+		ts.clear();
+	}
+
+	static node_ptr __balance( std::vector<node_ptr>& v, size_t lo, size_t hi )
+	{
+		if ( lo >= hi )
+			return 0;
+		size_t mid = lo + (hi - lo) / 2;
+		node_ptr p = v[mid];
+		p->lokid = __balance( v, lo, mid );
+		p->hikid = __balance( v, mid+1, hi );
+		return p;
+	}
+
+private:
+	std::vector<item>& v_;
+	std::vector<__job> jobs_;
+};
+
+// replaces the contents of m with [beg, end), pairs of ( tstring, T ) as for
+// the range constructor; of equal keys the last one wins, as with insert.
+// threads 0 means one per core.
+template<typename Map, typename Iter>
+void build_parallel( Map& m, Iter beg, Iter end, unsigned threads = 0 )
+{
+	typedef typename std::iterator_traits<Iter>::value_type pair_type;
+	typedef __parallel_builder<Map, pair_type> builder;
+
+	if ( threads == 0 )
+		threads = std::thread::hardware_concurrency();
+	if ( threads == 0 )
+		threads = 1;
+
+	std::vector<const pair_type*> v;
+	for ( ; beg != end; ++beg )
+	{
+		if ( !beg->first.empty() )
+			v.push_back( &*beg );
+	}
+	if ( threads > v.size() / 1024 + 1 ) // not worth a thread per few keys
+		threads = (unsigned)( v.size() / 1024 + 1 );
+
+	builder::sort( v, threads );
+
+	size_t n = 0; // keep the last of each run of equal keys
+	for ( size_t i = 0; i < v.size(); ++i )
+	{
+		if ( n > 0 && builder::key_equal( v[n-1], v[i] ) )
+			v[n-1] = v[i];
+		else
+			v[n++] = v[i];
+	}
+	v.resize( n );
+
+	builder b( v );
+	typename Map::node_ptr root = b.level( 0, n, 0, n / ( threads * 8 ) + 1 );
+	b.run_jobs( threads );
+	tst_access::adopt( m, root, n );
+}
+
+} // namespace tst
+
+#endif // TST_PARALLEL_H
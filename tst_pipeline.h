@@ -0,0 +1,250 @@
+/*
+author: suninf
+description: lookup_pipeline streams a text file of keys through a tst_map:
+			 a reader thread fills large blocks cut at line ends, worker
+			 threads split each block into keys in place and look them up,
+			 and the calling thread writes the results in input order. Blocks
+			 in flight are bounded, so memory stays flat on any input size,
+			 and no std::string is built per key.
+
+			 tst::lookup_pipeline( m, "keys.txt", "out.txt", tst::found_keys() );
+
+			 emit( out, key, len, value ) appends the result line of one key
+			 to out; value is 0 for a missing key. Needs C++11 threads.
+*/
+
+#ifndef TST_PIPELINE_H
+#define TST_PIPELINE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "tst_map.h"
+
+namespace tst {
+
+// emitters
+struct found_keys // the keys present in the map, one per line
+{
+	template<typename U>
+	void operator()( std::string& out, const char* key, size_t len, const U* v ) const
+	{
+		if ( v )
+		{
+			out.append( key, len );
+			out.push_back( '\n' );
+		}
+	}
+};
+
+struct missing_keys // the keys absent from the map, one per line
+{
+	template<typename U>
+	void operator()( std::string& out, const char* key, size_t len, const U* v ) const
+	{
+		if ( !v )
+		{
+			out.append( key, len );
+			out.push_back( '\n' );
+		}
+	}
+};
+
+struct pipeline_options
+{
+	pipeline_options()
+		: block_size(4 << 20), workers(0), blocks_in_flight(0), delim('\n') {}
+
+	size_t block_size;       // bytes read at a time, grown for longer lines
+	unsigned workers;        // lookup threads, 0 for one per core
+	size_t blocks_in_flight; // read ahead bound, 0 for two per worker
+	char delim;              // key separator; a '\r' before it is dropped too
+};
+
+// a queue that blocks push when full and pop when empty
+template<typename U>
+class __bounded_queue
+{
+public:
+	explicit __bounded_queue( size_t cap ) : cap_(cap ? cap : 1), closed_(false) {}
+
+	void push( const U& u )
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		not_full_.wait( lock, [this]() { return q_.size() < cap_; } );
+		q_.push_back( u );
+		not_empty_.notify_one();
+	}
+
+	bool pop( U& u ) // false once closed and drained
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		not_empty_.wait( lock, [this]() { return closed_ || !q_.empty(); } );
+		if ( q_.empty() )
+			return false;
+		u = q_.front();
+		q_.pop_front();
+		not_full_.notify_one();
+		return true;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		closed_ = true;
+		not_empty_.notify_all();
+	}
+
+private:
+	std::mutex mutex_;
+	std::condition_variable not_full_, not_empty_;
+	std::deque<U> q_;
+	size_t cap_;
+	bool closed_;
+};
+
+struct __pipeline_block
+{
+	__pipeline_block() : done(false) {}
+
+	std::string in;  // whole lines only
+	std::string out;
+	bool done;
+};
+
+// looks up every delim separated key of in and writes emit's output to out;
+// Map is a tst_map with Ch = char. Returns false on a read or write error.
+template<typename Map, typename Emit>
+bool lookup_pipeline( const Map& m, std::FILE* in, std::FILE* out, Emit emit,
+	pipeline_options opt = pipeline_options() )
+{
+	unsigned workers = opt.workers ? opt.workers : std::thread::hardware_concurrency();
+	if ( workers == 0 )
+		workers = 1;
+	size_t depth = opt.blocks_in_flight ? opt.blocks_in_flight : 2 * workers;
+	size_t block_size = opt.block_size ? opt.block_size : 1;
+
+	// the writer takes blocks in read order and waits for each to be done,
+	// so order holds every block in flight and bounds the read ahead
+	__bounded_queue<__pipeline_block*> work( depth ), order( depth );
+	std::mutex done_mutex;
+	std::condition_variable done_cv;
+	bool read_ok = true;
+
+	std::thread reader( [&]() {
+		std::string carry;
+		while ( true )
+		{
+			__pipeline_block* b = new __pipeline_block;
+			b->in.swap( carry );
+			size_t have = b->in.size();
+			b->in.resize( have + block_size );
+			size_t n = std::fread( &b->in[have], 1, block_size, in );
+			b->in.resize( have + n );
+			if ( n == 0 )
+			{
+				read_ok = !std::ferror( in );
+				if ( b->in.empty() )
+				{
+					delete b;
+					break;
+				}
+			}
+			else
+			{
+				std::string::size_type cut = b->in.rfind( opt.delim );
+				if ( cut == std::string::npos )
+				{// no line end yet, read more behind it
+					carry.swap( b->in );
+					delete b;
+					continue;
+				}
+				carry.assign( b->in, cut + 1, std::string::npos );
+				b->in.resize( cut + 1 );
+			}
+			order.push( b );
+			work.push( b );
+			if ( n == 0 )
+				break;
+		}
+		work.close();
+		order.close();
+	} );
+
+	std::vector<std::thread> lookups;
+	for ( unsigned t = 0; t < workers; ++t )
+	{
+		lookups.push_back( std::thread( [&]() {
+			Emit e = emit; // one per thread, emitters may keep state
+			__pipeline_block* b;
+			while ( work.pop( b ) )
+			{
+				const char* p = b->in.data();
+				const char* end = p + b->in.size();
+				while ( p < end )
+				{
+					const char* q = p;
+					while ( q < end && *q != opt.delim )
+						++q;
+					size_t len = q - p;
+					if ( len && p[len-1] == '\r' )
+						--len;
+					if ( len )
+						e( b->out, p, len, m.find_n( p, len ) );
+					p = q + 1;
+				}
+				std::lock_guard<std::mutex> lock( done_mutex );
+				b->done = true;
+				done_cv.notify_all();
+			}
+		} ) );
+	}
+
+	bool write_ok = true;
+	__pipeline_block* b;
+	while ( order.pop( b ) )
+	{
+		{
+			std::unique_lock<std::mutex> lock( done_mutex );
+			done_cv.wait( lock, [b]() { return b->done; } );
+		}
+		if ( write_ok && !b->out.empty()
+			&& std::fwrite( b->out.data(), 1, b->out.size(), out ) != b->out.size() )
+			write_ok = false;
+		delete b;
+	}
+
+	reader.join();
+	for ( size_t t = 0; t < lookups.size(); ++t )
+	{
+		lookups[t].join();
+	}
+	return read_ok && write_ok && std::fflush( out ) == 0;
+}
+
+template<typename Map, typename Emit>
+bool lookup_pipeline( const Map& m, const std::string& in_path, const std::string& out_path,
+	Emit emit, pipeline_options opt = pipeline_options() )
+{
+	std::FILE* in = std::fopen( in_path.c_str(), "rb" );
+	if ( !in )
+		return false;
+	std::FILE* out = std::fopen( out_path.c_str(), "wb" );
+	if ( !out )
+	{
+		std::fclose( in );
+		return false;
+	}
+	bool ok = lookup_pipeline( m, in, out, emit, opt );
+	std::fclose( in );
+	return ( std::fclose( out ) == 0 ) && ok;
+}
+
+} // namespace tst
+
+#endif // TST_PIPELINE_H
@@ -0,0 +1,91 @@
+/*
+author: suninf
+description: tst_reclaimer owns a background thread that frees retired
+			 tst_map trees, so clearing a huge map costs the caller one swap.
+
+			 tst::tst_reclaimer reclaimer;
+			 reclaimer.retire( big_map ); // big_map is empty right away
+
+			 Needs C++11 threads.
+*/
+
+#ifndef TST_RECLAIMER_H
+#define TST_RECLAIMER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace tst {
+
+class tst_reclaimer
+{
+public:
+	tst_reclaimer()
+		: stop_(false), thread_( &tst_reclaimer::__run, this ) {}
+
+	~tst_reclaimer() // frees everything still queued
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			stop_ = true;
+		}
+		cv_.notify_one();
+		thread_.join();
+	}
+
+	// take the nodes of m, which is left empty; Map is a tst_map
+	template<typename Map>
+	void retire( Map& m )
+	{
+		Map* old = new Map;
+		old->swap( m );
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			queue_.push_back( [old]() {
+				old->clear_incremental( size_t(-1) ); // iterative, no deep recursion
+				delete old;
+			} );
+		}
+		cv_.notify_one();
+	}
+
+	size_t pending() const // trees queued, not counting the one being freed
+	{
+		std::lock_guard<std::mutex> lock( mutex_ );
+		return queue_.size();
+	}
+
+private: // inner use for implement
+	void __run()
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		while ( true )
+		{
+			cv_.wait( lock, [this]() { return stop_ || !queue_.empty(); } );
+			if ( queue_.empty() )
+				return; // stopped
+			std::function<void()> job = std::move( queue_.front() );
+			queue_.pop_front();
+			lock.unlock();
+			job();
+			lock.lock();
+		}
+	}
+
+	tst_reclaimer( const tst_reclaimer& ) = delete;
+	tst_reclaimer& operator = ( const tst_reclaimer& ) = delete;
+
+private:
+	mutable std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque< std::function<void()> > queue_;
+	bool stop_;
+	std::thread thread_; // last, starts once the rest is ready
+};
+
+} // namespace tst
+
+#endif // TST_RECLAIMER_H
@@ -0,0 +1,258 @@
+/*
+author: suninf
+description: static_tst is a read-only ternary search tree built at compile time
+			 from a list of string literals, for keyword tables of lexers and
+			 protocol parsers. The nodes live in a plain array inside the object,
+			 a constexpr instance needs no initialization at run time, and find
+			 works both in constant expressions and at run time.
+
+			 constexpr auto keywords = tst::make_static_tst( "if", "else", "while" );
+			 static_assert( *keywords.find("else") == 1, "" );
+
+			 The value of a key is its position in the argument list. Needs C++14.
+*/
+
+#ifndef TST_STATIC_H
+#define TST_STATIC_H
+
+#if __cplusplus < 201402L && !( defined(_MSVC_LANG) && _MSVC_LANG >= 201402L )
+#error "tst_static.h needs C++14 relaxed constexpr"
+#endif
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+namespace tst {
+
+template< typename Ch >
+struct static_tnode
+{
+	Ch splitchar = 0;
+	int lokid = -1, eqkid = -1, hikid = -1; // index into the node array, -1 if none
+	int value = -1; // -1 if no key ends here
+};
+
+// K keys with at most N nodes in total
+template< typename Ch, size_t K, size_t N >
+class static_tst
+{
+public:
+	typedef std::basic_string<Ch> tstring;
+	typedef tstring key_type;
+
+	typedef int value_type;
+	typedef int const& const_reference;
+	typedef int const* const_pointer;
+
+public:
+	constexpr static_tst( const Ch* const (&keys)[K] )
+	{
+		int order[K > 0 ? K : 1] = {};
+		for ( size_t i = 0; i < K; ++i )
+		{
+			order[i] = (int)i;
+		}
+
+		// sort the keys and insert medians first, so every level is balanced
+		for ( size_t i = 1; i < K; ++i )
+		{
+			int cur = order[i];
+			size_t j = i;
+			while ( j > 0 && __less( keys[cur], keys[order[j-1]] ) )
+			{
+				order[j] = order[j-1];
+				--j;
+			}
+			order[j] = cur;
+		}
+		__insert_balanced( keys, order, 0, (int)K );
+	}
+
+	constexpr const_pointer find( const Ch* s ) const // exist if not return 0
+	{
+		int p = ( *s == 0 || count_ == 0 ) ? -1 : 0;
+		while ( p >= 0 )
+		{
+			const static_tnode<Ch>& n = nodes_[p];
+			if ( *s < n.splitchar )
+				p = n.lokid;
+			else if ( n.splitchar < *s )
+				p = n.hikid;
+			else
+			{
+				if ( *(++s) == 0 )
+				{
+					return n.value >= 0 ? &n.value : 0;
+				}
+				p = n.eqkid;
+			}
+		}
+		return 0;
+	}
+
+	const_pointer find( const tstring& str ) const { return find( str.c_str() ); }
+
+	// position of s in the argument list, -1 if absent
+	constexpr int index_of( const Ch* s ) const
+	{
+		const_pointer pos = find( s );
+		return pos ? *pos : -1;
+	}
+
+	constexpr size_t size() const { return size_; }
+
+	constexpr bool empty() const { return size_==0; }
+
+	constexpr size_t node_count() const { return count_; }
+
+	template<typename Func>
+	void foreach( Func f ) const // in key order, f( const tstring&, const int& )
+	{
+		tstring str;
+		if ( count_ )
+			__travel( 0, str, f );
+	}
+
+	template< typename Seq > // value_type: pair<string, int>
+	void sequence( Seq& c ) const
+	{
+		c.clear();
+		foreach( __push_back<Seq>(c) );
+	}
+
+private: // inner use for implement
+	static constexpr bool __less( const Ch* a, const Ch* b )
+	{
+		while ( *a && *a == *b )
+		{
+			++a;
+			++b;
+		}
+		return *a < *b;
+	}
+
+	static constexpr bool __equal( const Ch* a, const Ch* b )
+	{
+		return !__less( a, b ) && !__less( b, a );
+	}
+
+	constexpr void __insert_balanced( const Ch* const (&keys)[K], const int* order, int lo, int hi )
+	{
+		if ( lo >= hi )
+			return;
+		int mid = lo + (hi - lo) / 2;
+
+		// duplicates keep the first occurrence in the argument list
+		int first = mid;
+		while ( first > lo && __equal( keys[order[first-1]], keys[order[mid]] ) )
+			--first;
+		int pick = order[first];
+		for ( int i = first; i < hi && __equal( keys[order[i]], keys[order[mid]] ); ++i )
+		{
+			if ( order[i] < pick )
+				pick = order[i];
+		}
+		__insert( keys[pick], pick );
+
+		__insert_balanced( keys, order, lo, mid );
+		__insert_balanced( keys, order, mid+1, hi );
+	}
+
+	constexpr void __insert( const Ch* s, int value )
+	{
+		if ( *s == 0 )// ignore empty string
+			return;
+
+		int* link = 0;
+		int p = count_ ? 0 : -1;
+		while ( true )
+		{
+			if ( p < 0 )
+			{
+				p = (int)count_++;
+				nodes_[p].splitchar = *s;
+				if ( link )
+					*link = p;
+			}
+
+			static_tnode<Ch>& n = nodes_[p];
+			if ( *s < n.splitchar )
+				link = &n.lokid;
+			else if ( n.splitchar < *s )
+				link = &n.hikid;
+			else if ( *(s+1) == 0 )
+			{
+				if ( n.value < 0 )
+				{
+					n.value = value;
+					++size_;
+				}
+				return;
+			}
+			else
+			{
+				link = &n.eqkid;
+				++s;
+			}
+			p = *link;
+		}
+	}
+
+	template< typename Func >
+	void __travel( int p, tstring& cur_str, Func& f ) const
+	{
+		if ( p < 0 )
+			return;
+		const static_tnode<Ch>& n = nodes_[p];
+		__travel( n.lokid, cur_str, f );
+
+		cur_str.push_back( n.splitchar );
+		if ( n.value >= 0 )
+		{
+			f( (const tstring&)cur_str, n.value );
+		}
+		__travel( n.eqkid, cur_str, f );
+		cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+
+		__travel( n.hikid, cur_str, f );
+	}
+
+	template< typename Seq >
+	struct __push_back
+	{
+		Seq& seq_;
+		__push_back( Seq& s ) : seq_(s) {}
+		void operator()( const tstring& str, const int& v )
+		{
+			seq_.push_back( std::make_pair( str, v ) );
+		}
+	};
+
+private:
+	static_tnode<Ch> nodes_[N > 0 ? N : 1] = {};
+	size_t count_ = 0;
+	size_t size_ = 0;
+};
+
+namespace detail {
+
+constexpr size_t sum() { return 0; }
+
+template< typename... Ns >
+constexpr size_t sum( size_t n, Ns... ns ) { return n + sum( ns... ); }
+
+} // namespace detail
+
+// the node bound is the total length of the keys
+template< typename Ch, size_t... Ns >
+constexpr static_tst< Ch, sizeof...(Ns), detail::sum( (Ns - 1)... ) >
+make_static_tst( const Ch (&... keys)[Ns] )
+{
+	const Ch* const list[] = { keys... };
+	return static_tst< Ch, sizeof...(Ns), detail::sum( (Ns - 1)... ) >( list );
+}
+
+} // namespace tst
+
+#endif // TST_STATIC_H
@@ -0,0 +1,315 @@
+/*
+author: suninf
+description: tst_ttl_map is a tst_map whose entries expire. Each entry carries
+			 an expiry time; find treats expired entries as absent, and a timing
+			 wheel drives sweep(), which removes expired entries and prunes
+			 their nodes in bounded slices of work, so mass expiry never stalls
+			 a caller. Every insert also does a small slice of sweeping.
+
+			 size() counts expired entries until a sweep or find removes
+			 them. With C++11, tst_ttl_sweeper sweeps in the background: a
+			 thread of its own calls sweep( work ) every period, holding the
+			 mutex that guards the map. Entries live in a tst_linked_map and are erased through
+			 the parent links of their nodes, so no key is kept per entry.
+*/
+
+#ifndef TST_TTL_MAP_H
+#define TST_TTL_MAP_H
+
+#include <ctime>
+#include "tst_map.h"
+#include "tst_cache_map.h" // cache_links
+#include "tst_linked_map.h"
+
+#if __cplusplus >= 201103L || ( defined(_MSVC_LANG) && _MSVC_LANG >= 201103L )
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#define TST_HAS_THREADS 1
+#endif
+
+namespace tst {
+
+struct seconds_clock
+{
+	unsigned long long operator()() const { return (unsigned long long)std::time(0); }
+};
+
+template<typename T, typename Ch = char, typename Comp = std::less<Ch>,
+	typename Clock = seconds_clock>
+class tst_ttl_map
+{
+public:
+	typedef std::basic_string<Ch, std::char_traits<Ch>, std::allocator<Ch> > tstring;
+	typedef tstring key_type;
+	typedef unsigned long long time_type; // in units of Clock
+
+	typedef T value_type;
+	typedef T& reference;
+	typedef T* pointer;
+	typedef T const& const_reference;
+	typedef T const* const_pointer;
+
+public:
+	// the wheel has slots buckets of tick time units each
+	explicit tst_ttl_map( time_type default_ttl, size_t slots = 256, time_type tick = 1,
+		Clock clock = Clock() )
+		: default_ttl_(default_ttl), tick_(tick ? tick : 1), nslots_(slots ? slots : 1),
+		wheel_(new cache_links[slots ? slots : 1]), clock_(clock), sweep_per_insert_(2)
+	{
+		cursor_ = clock_() / tick_;
+		pos_ = 0;
+	}
+
+	~tst_ttl_map()
+	{
+		delete [] wheel_;
+	}
+
+	pointer insert( const tstring& str, const T& val )// may be just update if exist
+	{
+		return insert( str, val, default_ttl_ );
+	}
+
+	pointer insert( const tstring& str, const T& val, time_type ttl ) // expires ttl from now
+	{
+		if ( str.empty() )
+			return 0;
+		sweep( sweep_per_insert_ );
+
+		size_t n = map_.size();
+		__entry* e = &map_[str];
+		if ( map_.size() == n )
+			__unlink( e );
+		e->value = val;
+		__schedule( e, clock_() + ttl );
+		return &e->value;
+	}
+
+	pointer find( const tstring& str ) // an expired entry is removed on the way
+	{
+		__entry* e = map_.find( str );
+		if ( !e )
+			return 0;
+		if ( __expired( e, clock_() ) )
+		{
+			__drop( e );
+			return 0;
+		}
+		return &e->value;
+	}
+
+	const_pointer find( const tstring& str ) const
+	{
+		const __entry* e = map_.find( str );
+		return ( e && !__expired( e, clock_() ) ) ? &e->value : 0;
+	}
+
+	bool expire( const tstring& str, time_type ttl ) // reset the time to live of a live entry
+	{
+		__entry* e = map_.find( str );
+		if ( !e || __expired( e, clock_() ) )
+			return false;
+		__unlink( e );
+		__schedule( e, clock_() + ttl );
+		return true;
+	}
+
+	bool remove( const tstring& str )
+	{
+		__entry* e = map_.find( str );
+		if ( !e )
+			return false;
+		__drop( e );
+		return true;
+	}
+
+	bool erase( const tstring& str ) { return remove(str); }
+
+	void clear()
+	{
+		for ( size_t i = 0; i < nslots_; ++i )
+		{
+			wheel_[i].prev = wheel_[i].next = &wheel_[i];
+		}
+		pos_ = 0;
+		map_.clear();
+	}
+
+	// advance the wheel up to now, visiting at most work entries;
+	// returns the number of expired entries removed
+	size_t sweep( size_t work )
+	{
+		time_type now = clock_();
+		time_type now_tick = now / tick_;
+		if ( now_tick >= nslots_ && cursor_ < now_tick - nslots_ + 1 )
+		{// idle for a whole turn, every slot is due once
+			cursor_ = now_tick - nslots_ + 1;
+			pos_ = 0;
+		}
+
+		size_t removed = 0;
+		while ( work > 0 )
+		{
+			cache_links* head = &wheel_[ cursor_ % nslots_ ];
+			if ( pos_ == 0 )
+				pos_ = head->next;
+
+			if ( pos_ == head )
+			{// slot done, move to the next tick if it is due
+				if ( cursor_ >= now_tick )
+				{
+					pos_ = 0;
+					break;
+				}
+				++cursor_;
+				pos_ = 0;
+				continue;
+			}
+
+			__entry* e = static_cast<__entry*>( pos_ );
+			pos_ = pos_->next;
+			if ( e->expire <= now )
+			{
+				__drop( e );
+				++removed;
+			}
+			--work;
+		}
+		return removed;
+	}
+
+	void sweep_per_insert( size_t work ) { sweep_per_insert_ = work; }
+
+	// entries stored, including expired ones not swept yet; sweep( size() )
+	// first for the live count
+	size_t size() const { return map_.size(); }
+
+	bool empty() const { return map_.empty(); }
+
+	template<typename Func>
+	void foreach( Func f ) const // live entries, f( const tstring&, const T& )
+	{
+		map_.foreach( __live_call<Func>( f, clock_() ) );
+	}
+
+private: // inner use for implement
+	struct __entry : cache_links
+	{
+		T value;
+		time_type expire;
+	};
+
+	static bool __expired( const __entry* e, time_type now ) { return e->expire <= now; }
+
+	void __schedule( __entry* e, time_type expire )
+	{
+		e->expire = expire;
+		time_type t = expire / tick_;
+		if ( t < cursor_ )
+			t = cursor_;
+		e->link_before( &wheel_[ t % nslots_ ] );
+	}
+
+	void __unlink( __entry* e )
+	{
+		if ( pos_ == e )
+			pos_ = e->next;
+		e->unlink();
+	}
+
+	void __drop( __entry* e )
+	{
+		__unlink( e );
+		map_.erase( map_.handle_of( e ) );
+	}
+
+	template< typename Func >
+	struct __live_call
+	{
+		Func f_;
+		time_type now_;
+		__live_call( Func f, time_type now ) : f_(f), now_(now) {}
+		void operator()( const tstring& str, const __entry& e )
+		{
+			if ( !__expired( &e, now_ ) )
+				f_( str, e.value );
+		}
+	};
+
+	tst_ttl_map( const tst_ttl_map& ); // entries are linked, not copyable
+	tst_ttl_map& operator = ( const tst_ttl_map& );
+
+private:
+	tst_linked_map<__entry, Ch, Comp> map_;
+	time_type default_ttl_;
+	time_type tick_;
+	size_t nslots_;
+	cache_links* wheel_;
+	time_type cursor_; // the tick being swept
+	cache_links* pos_; // next entry to visit in the cursor's slot, 0 for its start
+	Clock clock_;
+	size_t sweep_per_insert_;
+};
+
+#ifdef TST_HAS_THREADS
+// sweeps a tst_ttl_map from a thread of its own until destroyed; every
+// other use of the map must hold lock as well
+template<typename Map, typename Mutex = std::mutex>
+class tst_ttl_sweeper
+{
+public:
+	tst_ttl_sweeper( Map& m, Mutex& lock, std::chrono::milliseconds period, size_t work = 1024 )
+		: map_(m), lock_(lock), period_(period), work_(work ? work : 1), swept_(0),
+		stop_(false), thread_( &tst_ttl_sweeper::__run, this ) {}
+
+	~tst_ttl_sweeper()
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			stop_ = true;
+		}
+		cv_.notify_one();
+		thread_.join();
+	}
+
+	tst_ttl_sweeper( const tst_ttl_sweeper& ) = delete;
+	tst_ttl_sweeper& operator = ( const tst_ttl_sweeper& ) = delete;
+
+	size_t swept() const { return swept_; } // expired entries removed so far
+
+private: // inner use for implement
+	void __run()
+	{
+		std::unique_lock<std::mutex> lock( mutex_ );
+		while ( !cv_.wait_for( lock, period_, [this]() { return stop_; } ) )
+		{
+			lock.unlock();
+			size_t n;
+			{
+				std::lock_guard<Mutex> guard( lock_ );
+				n = map_.sweep( work_ );
+			}
+			swept_ += n;
+			lock.lock();
+		}
+	}
+
+private:
+	Map& map_;
+	Mutex& lock_;
+	std::chrono::milliseconds period_;
+	size_t work_;
+	std::atomic<size_t> swept_;
+	std::mutex mutex_; // for stop_
+	std::condition_variable cv_;
+	bool stop_;
+	std::thread thread_; // last, starts once the rest is ready
+};
+#endif
+
+} // namespace tst
+
+#endif // TST_TTL_MAP_H
@@ -0,0 +1,408 @@
+/*
+author: suninf
+description: tst_utf8_map keeps wide-character keys (wchar_t, char32_t ...) as
+			 UTF-8 byte sequences in a tst_map<T, char>, so every node holds a
+			 one byte splitchar. Keys are encoded on input and decoded on output;
+			 nearsearch and pmsearch work per code point, not per byte.
+*/
+
+#ifndef TST_UTF8_MAP_H
+#define TST_UTF8_MAP_H
+
+#include <vector>
+#include "tst_map.h"
+
+namespace tst {
+
+// compare UTF-8 bytes unsigned, so the byte order equals the code point order
+struct utf8_less
+{
+	bool operator()( char a, char b ) const
+	{
+		return (unsigned char)a < (unsigned char)b;
+	}
+};
+
+namespace utf8 {
+
+typedef unsigned long code_point;
+
+// length of the sequence starting with lead, stray continuation bytes count 1
+inline int seq_len( unsigned char lead )
+{
+	if ( lead < 0xC0 )
+		return 1;
+	if ( lead < 0xE0 )
+		return 2;
+	if ( lead < 0xF0 )
+		return 3;
+	return 4;
+}
+
+inline void append( code_point cp, std::string& out )
+{
+	if ( cp > 0x10FFFF )
+		cp = 0xFFFD;
+
+	if ( cp < 0x80 )
+		out.push_back( (char)cp );
+	else if ( cp < 0x800 )
+	{
+		out.push_back( (char)(0xC0 | (cp >> 6)) );
+		out.push_back( (char)(0x80 | (cp & 0x3F)) );
+	}
+	else if ( cp < 0x10000 )
+	{
+		out.push_back( (char)(0xE0 | (cp >> 12)) );
+		out.push_back( (char)(0x80 | ((cp >> 6) & 0x3F)) );
+		out.push_back( (char)(0x80 | (cp & 0x3F)) );
+	}
+	else
+	{
+		out.push_back( (char)(0xF0 | (cp >> 18)) );
+		out.push_back( (char)(0x80 | ((cp >> 12) & 0x3F)) );
+		out.push_back( (char)(0x80 | ((cp >> 6) & 0x3F)) );
+		out.push_back( (char)(0x80 | (cp & 0x3F)) );
+	}
+}
+
+inline code_point decode_one( const char* s, int len )
+{
+	const unsigned char* u = (const unsigned char*)s;
+	switch ( len )
+	{
+	case 2: return ((u[0] & 0x1F) << 6) | (u[1] & 0x3F);
+	case 3: return ((u[0] & 0x0F) << 12) | ((u[1] & 0x3F) << 6) | (u[2] & 0x3F);
+	case 4: return ((code_point)(u[0] & 0x07) << 18) | ((u[1] & 0x3F) << 12)
+				| ((u[2] & 0x3F) << 6) | (u[3] & 0x3F);
+	default: return u[0];
+	}
+}
+
+// read one code point from a wide string, joining utf-16 surrogate pairs
+template<typename WCh>
+code_point next( const WCh*& s )
+{
+	code_point cp = (code_point)(*s++);
+	if ( sizeof(WCh) == 2 )
+	{
+		cp &= 0xFFFF;
+		if ( cp >= 0xD800 && cp < 0xDC00 && (code_point)(*s & 0xFFFF) - 0xDC00 < 0x400 )
+		{
+			cp = 0x10000 + ((cp - 0xD800) << 10) + ((code_point)(*s++ & 0xFFFF) - 0xDC00);
+		}
+	}
+	return cp;
+}
+
+template<typename WCh>
+void push_wide( code_point cp, std::basic_string<WCh>& out )
+{
+	if ( sizeof(WCh) == 2 && cp >= 0x10000 )
+	{
+		cp -= 0x10000;
+		out.push_back( (WCh)(0xD800 + (cp >> 10)) );
+		out.push_back( (WCh)(0xDC00 + (cp & 0x3FF)) );
+	}
+	else
+		out.push_back( (WCh)cp );
+}
+
+template<typename WCh>
+void encode( const WCh* s, std::string& out )
+{
+	out.clear();
+	while ( *s )
+	{
+		append( next(s), out );
+	}
+}
+
+template<typename WCh>
+void decode( const std::string& s, std::basic_string<WCh>& out )
+{
+	out.clear();
+	size_t i = 0;
+	while ( i < s.size() )
+	{
+		int len = seq_len( (unsigned char)s[i] );
+		if ( i + len > s.size() )
+			len = 1;
+		push_wide( decode_one( s.data() + i, len ), out );
+		i += len;
+	}
+}
+
+} // namespace utf8
+
+template<typename T, typename WCh = wchar_t>
+class tst_utf8_map
+{
+public:
+	typedef std::basic_string<WCh> tstring;
+	typedef tstring key_type;
+	typedef tst_map<T, char, utf8_less> byte_map;
+	typedef typename byte_map::node_ptr node_ptr;
+
+	typedef T value_type;
+	typedef T& reference;
+	typedef T* pointer;
+	typedef T const& const_reference;
+	typedef T const* const_pointer;
+
+public:
+	tst_utf8_map() {}
+
+	template<typename Iter>
+	tst_utf8_map( Iter beg, Iter end )
+	{
+		insert( beg, end );
+	}
+
+	pointer insert( const WCh* str, const T& val )// may be just update if exist
+	{
+		return map_.insert( __encode(str), val );
+	}
+
+	pointer insert( const tstring& str, const T& val )
+	{
+		return insert( str.c_str(), val );
+	}
+
+	pointer insert( const std::pair<tstring, T>& pair_val )
+	{
+		return insert( pair_val.first.c_str(), pair_val.second );
+	}
+
+	template<typename Iter>
+	void insert( Iter beg, Iter end ) // insert [beg, end), value_type: pair<wstring, T>
+	{
+		while ( beg != end )
+		{
+			insert( beg->first, beg->second );
+			++beg;
+		}
+	}
+
+	pointer find( const WCh* str ) { return map_.find( __encode(str) ); }
+	pointer find( const tstring& str ) { return find( str.c_str() ); }
+	const_pointer find( const WCh* str ) const { return map_.find( __encode(str) ); }
+	const_pointer find( const tstring& str ) const { return find( str.c_str() ); }
+
+	reference operator[]( const tstring& str ) { return map_[ __encode(str.c_str()) ]; }
+	const T operator[]( const tstring& str ) const { return map_[ __encode(str.c_str()) ]; }
+
+	bool remove( const tstring& str ) { return map_.remove( __encode(str.c_str()) ); }
+	bool erase( const tstring& str ) { return remove(str); }
+
+	void clear() { map_.clear(); }
+	void swap( tst_utf8_map& m ) { map_.swap( m.map_ ); }
+
+	size_t size() const { return map_.size(); }
+	bool empty() const { return map_.empty(); }
+
+	// the underlying byte tree, keys are UTF-8
+	byte_map& bytes() { return map_; }
+	const byte_map& bytes() const { return map_; }
+
+	template<typename Func>
+	void foreach( Func f )
+	{
+		map_.foreach( __decode_call<Func>(f) );
+	}
+
+	template<typename Func>
+	void foreach( Func f ) const
+	{
+		map_.foreach( __decode_call<Func>(f) );
+	}
+
+	template< typename Seq > // value_type: pair<wstring, T>
+	void sequence( Seq& c ) const
+	{
+		c.clear();
+		map_.foreach( __decode_call< __push_back<Seq> >( __push_back<Seq>(c) ) );
+	}
+
+	template< typename Seq >
+	void nearsearch( const tstring& str, int d, Seq& c ) const // at most d different code points
+	{
+		__query q( str.c_str() );
+		std::string cur;
+		c.clear();
+		__near_search( map_.root(), q, 0, d, cur, 0, c );
+	}
+
+	template< typename Seq >
+	void pmsearch( const tstring& str, Seq& c ) const // '.' matches one code point
+	{
+		__query q( str.c_str() );
+		std::string cur;
+		c.clear();
+		__pmsearch( map_.root(), q, 0, cur, 0, c );
+	}
+
+private: // inner use for implement
+	static std::string __encode( const WCh* s )
+	{
+		std::string bytes;
+		utf8::encode( s, bytes );
+		return bytes;
+	}
+
+	static tstring __decode( const std::string& s )
+	{
+		tstring str;
+		utf8::decode( s, str );
+		return str;
+	}
+
+	// search pattern split into code points, with the UTF-8 bytes of each
+	struct __query
+	{
+		std::vector<utf8::code_point> cps;
+		std::vector<size_t> offs;
+		std::string bytes;
+
+		explicit __query( const WCh* s )
+		{
+			while ( *s )
+			{
+				cps.push_back( utf8::next(s) );
+				offs.push_back( bytes.size() );
+				utf8::append( cps.back(), bytes );
+			}
+		}
+
+		size_t size() const { return cps.size(); }
+		unsigned char byte( size_t i, size_t k ) const { return (unsigned char)bytes[ offs[i] + k ]; }
+	};
+
+	template< typename Seq >
+	void __pmsearch( node_ptr p, const __query& q, size_t i, std::string& cur_str,
+		size_t cp_start, Seq& c ) const
+	{
+		if ( !p || i >= q.size() )
+			return;
+
+		size_t k = cur_str.size() - cp_start;
+		bool any = q.cps[i] == '.';
+		unsigned char ch = (unsigned char)p->splitchar;
+		unsigned char want = any ? 0 : q.byte( i, k );
+
+		if ( any || want < ch )
+		{
+			__pmsearch( p->lokid, q, i, cur_str, cp_start, c );
+		}
+		if ( any || want == ch )
+		{
+			cur_str.push_back( p->splitchar );
+			if ( (int)(k+1) >= utf8::seq_len( (unsigned char)cur_str[cp_start] ) )
+			{// a whole code point matched
+				if ( i+1 == q.size() && p->pdata )
+				{
+					c.push_back( std::make_pair( __decode(cur_str), *(p->pdata) ) );
+				}
+				else if ( i+1 < q.size() )
+				{
+					__pmsearch( p->eqkid, q, i+1, cur_str, cur_str.size(), c );
+				}
+			}
+			else
+			{
+				__pmsearch( p->eqkid, q, i, cur_str, cp_start, c );
+			}
+			cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		}
+		if ( any || want > ch )
+		{
+			__pmsearch( p->hikid, q, i, cur_str, cp_start, c );
+		}
+	}
+
+	template< typename Seq >
+	void __near_search( node_ptr p, const __query& q, size_t i, int d, std::string& cur_str,
+		size_t cp_start, Seq& seq ) const
+	{
+		if ( p==0 || d<0 )
+			return;
+
+		// with no budget left the walk can only follow the query bytes
+		bool exact = ( d == 0 );
+		if ( exact && i >= q.size() )
+			return;
+
+		size_t k = cur_str.size() - cp_start;
+		unsigned char ch = (unsigned char)p->splitchar;
+		unsigned char want = exact ? q.byte( i, k ) : 0;
+
+		if ( !exact || want < ch )
+		{
+			__near_search( p->lokid, q, i, d, cur_str, cp_start, seq );
+		}
+		if ( !exact || want == ch )
+		{
+			cur_str.push_back( p->splitchar );
+			int len = utf8::seq_len( (unsigned char)cur_str[cp_start] );
+			if ( (int)(k+1) >= len )
+			{// a whole code point, compare it against the query
+				utf8::code_point cp = utf8::decode_one( cur_str.data() + cp_start, len );
+				int nd = ( i < q.size() && cp == q.cps[i] ) ? d : d-1;
+				size_t ni = i < q.size() ? i+1 : i;
+				if ( nd >= 0 )
+				{
+					if ( p->pdata && q.size() - ni <= (size_t)nd )
+					{
+						seq.push_back( std::make_pair( __decode(cur_str), *(p->pdata) ) );
+					}
+					__near_search( p->eqkid, q, ni, nd, cur_str, cur_str.size(), seq );
+				}
+			}
+			else
+			{
+				__near_search( p->eqkid, q, i, d, cur_str, cp_start, seq );
+			}
+			cur_str.erase( cur_str.begin() + cur_str.size() - 1 );
+		}
+		if ( !exact || want > ch )
+		{
+			__near_search( p->hikid, q, i, d, cur_str, cp_start, seq );
+		}
+	}
+
+	template< typename Func >
+	struct __decode_call
+	{
+		Func f_;
+		__decode_call( Func f ) : f_(f) {}
+		template<typename U>
+		void operator()( const std::string& str, U& t )
+		{
+			f_( __decode(str), t );
+		}
+	};
+
+	template< typename Seq >
+	struct __push_back
+	{
+		Seq* seq_;
+		__push_back( Seq& s ) : seq_(&s) {}
+		void operator()( const tstring& str, const T& t )
+		{
+			seq_->push_back( std::make_pair( str, t ) );
+		}
+	};
+
+private:
+	byte_map map_;
+};
+
+template<typename T, typename WCh>
+void swap( tst_utf8_map<T, WCh>& lhs, tst_utf8_map<T, WCh>& rhs )
+{
+	lhs.swap( rhs );
+}
+
+} // namespace tst
+
+#endif // TST_UTF8_MAP_H